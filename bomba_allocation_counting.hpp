@@ -0,0 +1,80 @@
+#ifndef BOMBA_ALLOCATION_COUNTING
+#define BOMBA_ALLOCATION_COUNTING
+
+// Replaces the global allocation functions with ones that count allocations, meant for tests and benchmarks.
+// The replacements are not inline, so this can be included only by one translation unit of a program.
+
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <cstdint>
+
+namespace Bomba::AllocationCounting {
+
+// Allocations made by all threads
+inline std::atomic<int64_t> total = 0;
+
+// Allocations made by the current thread while enabled, to find allocations on paths that aren't supposed to allocate
+inline thread_local bool threadCountingEnabled = false;
+inline thread_local int64_t threadCount = 0;
+
+inline void* allocate(std::size_t size, std::size_t alignment = 0) {
+	total.fetch_add(1, std::memory_order_relaxed);
+	if (threadCountingEnabled) [[unlikely]]
+		threadCount++;
+	if (size == 0)
+		size = 1;
+	void* allocated = nullptr;
+	if (alignment > alignof(std::max_align_t))
+		allocated = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+	else
+		allocated = std::malloc(size);
+	if (!allocated) [[unlikely]]
+		throw std::bad_alloc();
+	return allocated;
+}
+
+} // namespace Bomba::AllocationCounting
+
+// All forms are replaced, so that every allocation is counted and released by the matching function. Allocation
+// and deallocation are not inlined, because GCC would otherwise see free() used on memory from operator new (or delete
+// used on memory from malloc()) and warn about a mismatch.
+[[gnu::noinline]] void* operator new(std::size_t size) {
+	return Bomba::AllocationCounting::allocate(size);
+}
+[[gnu::noinline]] void* operator new[](std::size_t size) {
+	return Bomba::AllocationCounting::allocate(size);
+}
+[[gnu::noinline]] void* operator new(std::size_t size, std::align_val_t alignment) {
+	return Bomba::AllocationCounting::allocate(size, std::size_t(alignment));
+}
+[[gnu::noinline]] void* operator new[](std::size_t size, std::align_val_t alignment) {
+	return Bomba::AllocationCounting::allocate(size, std::size_t(alignment));
+}
+
+[[gnu::noinline]] void operator delete(void* allocated) noexcept {
+	std::free(allocated);
+}
+[[gnu::noinline]] void operator delete(void* allocated, std::size_t) noexcept {
+	std::free(allocated);
+}
+[[gnu::noinline]] void operator delete[](void* allocated) noexcept {
+	std::free(allocated);
+}
+[[gnu::noinline]] void operator delete[](void* allocated, std::size_t) noexcept {
+	std::free(allocated);
+}
+[[gnu::noinline]] void operator delete(void* allocated, std::align_val_t) noexcept {
+	std::free(allocated);
+}
+[[gnu::noinline]] void operator delete(void* allocated, std::size_t, std::align_val_t) noexcept {
+	std::free(allocated);
+}
+[[gnu::noinline]] void operator delete[](void* allocated, std::align_val_t) noexcept {
+	std::free(allocated);
+}
+[[gnu::noinline]] void operator delete[](void* allocated, std::size_t, std::align_val_t) noexcept {
+	std::free(allocated);
+}
+
+#endif // BOMBA_ALLOCATION_COUNTING
@@ -0,0 +1,595 @@
+//usr/bin/g++ --std=c++20 -Wall $0 -O2 -lpthread -o ${o=`mktemp`} && exec $o $*
+// Benchmarks serialisation, RPC and HTTP, all in one process and over loopback. Results are printed to standard output
+// as JSON to allow comparing builds or releases, progress goes to standard error.
+// If an argument is given, only benchmarks whose names contain it are run.
+#include <iostream>
+#include <vector>
+#include <string>
+#include <array>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <latch>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "bomba_core.hpp"
+#include "bomba_json.hpp"
+#include "bomba_object.hpp"
+#include "bomba_rpc_object.hpp"
+#include "bomba_json_rpc.hpp"
+#include "bomba_http.hpp"
+#include "bomba_tcp_server.hpp"
+#include "bomba_io_uring_server.hpp"
+#include "bomba_sync_client.hpp"
+#include "bomba_binary_protocol.hpp"
+#include "bomba_download_server.hpp"
+#include "bomba_loopback_client.hpp"
+#include "bomba_shared_memory.hpp"
+#include "bomba_udp.hpp"
+#include "bomba_allocation_counting.hpp"
+
+using namespace Bomba;
+
+// Counts instructions executed in user space by this thread and threads started later, if the kernel allows it.
+// Threads' instructions are added only when they end, so the count includes starting and stopping the servers.
+class InstructionCounter {
+	int _descriptor = -1;
+
+public:
+	InstructionCounter() {
+		perf_event_attr attributes = {};
+		attributes.type = PERF_TYPE_HARDWARE;
+		attributes.size = sizeof(attributes);
+		attributes.config = PERF_COUNT_HW_INSTRUCTIONS;
+		attributes.exclude_kernel = true;
+		attributes.exclude_hv = true;
+		attributes.inherit = true;
+		_descriptor = syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+	}
+	InstructionCounter(const InstructionCounter&) = delete;
+	void operator=(const InstructionCounter&) = delete;
+	~InstructionCounter() {
+		if (_descriptor >= 0)
+			close(_descriptor);
+	}
+
+	// Returns -1 if instructions can't be counted
+	int64_t read() const {
+		uint64_t value = 0;
+		if (_descriptor < 0 || ::read(_descriptor, &value, sizeof(value)) != sizeof(value))
+			return -1;
+		return value;
+	}
+};
+
+// Times individual requests of one benchmark, only requests between start() and stop() are counted
+class Measurement {
+	LatencyHistogram _latency;
+	std::chrono::steady_clock::time_point _startTime = {};
+	std::chrono::steady_clock::time_point _stopTime = {};
+	int64_t _allocationsAtStart = 0;
+	int64_t _allocations = 0;
+	bool _running = false;
+	bool _concurrent = false;
+
+public:
+	// Requests can be recorded from several threads at once if concurrent
+	void start(bool concurrent = false) {
+		_running = true;
+		_concurrent = concurrent;
+		// Allocations of all threads, the benchmarks include both the servers and the clients
+		_allocationsAtStart = AllocationCounting::total.load(std::memory_order_relaxed);
+		_startTime = std::chrono::steady_clock::now();
+	}
+	void stop() {
+		_stopTime = std::chrono::steady_clock::now();
+		_allocations = AllocationCounting::total.load(std::memory_order_relaxed) - _allocationsAtStart;
+		_running = false;
+	}
+	void record(std::chrono::steady_clock::time_point sent, std::chrono::steady_clock::time_point received) {
+		if (!_running)
+			return;
+		if (_concurrent) [[unlikely]]
+			_latency.recordConcurrently(received - sent);
+		else
+			_latency.record(received - sent);
+	}
+
+	LatencySnapshot latency() const {
+		LatencySnapshot snapshot;
+		_latency.addTo(snapshot);
+		return snapshot;
+	}
+	std::chrono::nanoseconds duration() const {
+		return _stopTime - _startTime;
+	}
+	int64_t allocations() const {
+		return _allocations;
+	}
+};
+
+// Objects of several shapes for serialisation
+struct SmallObject : Serialisable<SmallObject> {
+	int index = key<"index"> = 17;
+	int count = key<"count"> = 256;
+	bool enabled = key<"enabled"> = true;
+};
+
+struct TextObject : Serialisable<TextObject> {
+	std::string name = key<"name"> = "Serialisation benchmark";
+	std::string description = key<"description"> = "An object consisting mostly of strings that are too long "
+			"to fit into the small string optimisation, so that copying them is not free";
+	int version = key<"version"> = 3;
+};
+
+struct NestedObject : Serialisable<NestedObject> {
+	std::string title = key<"title"> = "Nested";
+	std::vector<SmallObject> items = key<"items"> = std::vector<SmallObject>(16);
+	TextObject details = key<"details">;
+};
+
+struct BenchmarkApi : RpcObject<BenchmarkApi> {
+	std::string message;
+
+	RpcMember<[] (int first = name("first"), int second = name("second")) {
+		return first + second;
+	}> sum = child<"sum">;
+
+	RpcMember<[] (BenchmarkApi* parent, std::string newMessage = name("message")) {
+		parent->message = newMessage;
+	}> setMessage = child<"set_message">;
+};
+
+static std::string postedMessage;
+using PostMethod = RpcStatelessLambda<[] (std::string message = name("message")) {
+	postedMessage = message;
+}>;
+
+// Headers as sent by common clients
+const std::string browserRequest = "GET /stylesheets/colourful_page_style.css HTTP/1.1\r\n"
+		"Host: localhost:8080\r\n"
+		"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:131.0) Gecko/20100101 Firefox/131.0\r\n"
+		"Accept: text/css,*/*;q=0.1\r\n"
+		"Accept-Language: en-GB,en;q=0.7,cs;q=0.3\r\n"
+		"Accept-Encoding: gzip, deflate, br, zstd\r\n"
+		"Connection: keep-alive\r\n"
+		"Referer: http://localhost:8080/index.html\r\n"
+		"Cookie: session=4f1c2a9e8b7d6c5a4f3e2d1c0b9a8f7e; theme=dark; consent=necessary%2Cstatistics\r\n"
+		"Sec-Fetch-Dest: style\r\n"
+		"Sec-Fetch-Mode: no-cors\r\n"
+		"Sec-Fetch-Site: same-origin\r\n"
+		"Priority: u=2\r\n"
+		"Pragma: no-cache\r\n"
+		"Cache-Control: no-cache\r\n\r\n";
+const std::string curlRequest = "GET /index.html HTTP/1.1\r\n"
+		"Host: localhost:8080\r\n"
+		"User-Agent: curl/8.5.0\r\n"
+		"Accept: */*\r\n\r\n";
+
+struct HeaderCounter : Detail::HttpParseState {
+	int headers = 0;
+	bool firstLineReader(std::string_view) override {
+		return true;
+	}
+	void headerReader(std::string_view, std::string_view, std::pair<int, int>) override {
+		headers++;
+	}
+};
+
+constexpr int port = 8902;
+const std::string targetAddress = "0.0.0.0";
+const std::string targetPort = std::to_string(port);
+const std::string socketPath = (std::filesystem::temp_directory_path() / "bomba_benchmark.sock").string();
+
+// Over loopback TCP or over a Unix domain socket, to compare them
+template <typename Responder>
+struct Connection {
+	BackgroundTcpServer<Responder> server;
+	SyncNetworkClient client;
+
+	Connection(Responder& responder, bool unixSocket)
+			: server(unixSocket ? BackgroundTcpServer<Responder>(responder, UnixSocketPath{socketPath})
+					: BackgroundTcpServer<Responder>(responder, port)),
+			client(unixSocket ? SyncNetworkClient(UnixSocketPath{socketPath}) : SyncNetworkClient(targetAddress, targetPort)) {}
+};
+
+// Keeps the given number of requests in flight, started by send() and finished by receive() in the same order
+template <int Depth, typename Token>
+void pipeline(Measurement& measurement, int64_t requests, auto send, auto receive) {
+	struct Pending {
+		Token token = {};
+		std::chrono::steady_clock::time_point sent = {};
+	};
+	std::array<Pending, Depth> pending = {};
+	auto finish = [&] (Pending& finished) {
+		receive(finished.token);
+		measurement.record(finished.sent, std::chrono::steady_clock::now());
+	};
+	for (int64_t i = 0; i < requests; i++) {
+		Pending& slot = pending[i % Depth];
+		if (i >= Depth)
+			finish(slot);
+		slot.sent = std::chrono::steady_clock::now();
+		slot.token = send();
+	}
+	for (int64_t i = std::max<int64_t>(0, requests - Depth); i < requests; i++)
+		finish(pending[i % Depth]);
+}
+
+// Runs each client in a thread of its own with an equal share of the requests, a client prepares itself and then calls
+// the function it gets, which returns when all clients are prepared and the measurement has started
+void concurrently(Measurement& measurement, int64_t requests, int clients, auto client) {
+	std::latch prepared(clients);
+	std::latch started(1);
+	{
+		std::vector<std::jthread> workers;
+		for (int i = 0; i < clients; i++) {
+			workers.emplace_back([&] {
+				client(requests / clients, [&] {
+					prepared.count_down();
+					started.wait();
+				});
+			});
+		}
+		prepared.wait();
+		measurement.start(true);
+		started.count_down();
+	}
+	measurement.stop();
+}
+
+int main(int argc, char** argv) {
+	std::string_view filter = (argc > 1) ? argv[1] : "";
+	InstructionCounter instructions;
+	std::string results;
+	typename BasicJson<std::string>::Output json(results);
+	{
+	auto root = json.writeObject();
+	root.writeString("compiler", __VERSION__);
+	auto benchmarks = root.writeArray("benchmarks");
+
+	// The run function must prepare everything, call start(), do the given number of requests and call stop()
+	auto benchmark = [&] (std::string_view name, int64_t requests, auto run) {
+		if (name.find(filter) == std::string_view::npos)
+			return;
+		std::cerr << "Benchmarking " << name << "..." << std::endl;
+		Measurement measurement;
+		int64_t instructionsBefore = instructions.read();
+		run(measurement, requests);
+		int64_t instructionsAfter = instructions.read();
+
+		LatencySnapshot latency = measurement.latency();
+		double seconds = measurement.duration().count() / 1e9;
+		auto result = benchmarks.writeObject();
+		result.writeString("name", name);
+		result.writeInt("requests", requests);
+		result.writeFloat("seconds", seconds);
+		result.writeFloat("requests_per_second", requests / seconds);
+		{
+			auto latencyObject = result.writeObject("latency_ns");
+			latencyObject.writeInt("mean", latency.mean().count());
+			latencyObject.writeInt("p50", latency.percentile(0.5).count());
+			latencyObject.writeInt("p90", latency.percentile(0.9).count());
+			latencyObject.writeInt("p99", latency.percentile(0.99).count());
+			latencyObject.writeInt("p999", latency.percentile(0.999).count());
+			latencyObject.writeInt("max", latency.max().count());
+		}
+		result.writeFloat("allocations_per_request", double(measurement.allocations()) / requests);
+		if (instructionsBefore >= 0 && instructionsAfter >= 0)
+			result.writeFloat("instructions_per_request", double(instructionsAfter - instructionsBefore) / requests);
+		else
+			result.writeNull("instructions_per_request");
+	};
+
+	auto serialisation = [&] <typename Object> (std::string_view shape) {
+		Object object;
+		auto measureFormat = [&] <typename Format> (std::string_view format) {
+			std::string name = std::string(format) + " serialisation of " + std::string(shape);
+			benchmark(name, 200000, [&] (Measurement& measurement, int64_t requests) {
+				std::string output;
+				measurement.start();
+				for (int64_t i = 0; i < requests; i++) {
+					auto started = std::chrono::steady_clock::now();
+					output.clear();
+					object.template serialise<Format>(output);
+					measurement.record(started, std::chrono::steady_clock::now());
+				}
+				measurement.stop();
+			});
+
+			std::string serialised = object.template serialise<Format>();
+			name = std::string(format) + " deserialisation of " + std::string(shape);
+			benchmark(name, 200000, [&] (Measurement& measurement, int64_t requests) {
+				Object read;
+				read.template deserialise<Format>(serialised);
+				measurement.start();
+				for (int64_t i = 0; i < requests; i++) {
+					auto started = std::chrono::steady_clock::now();
+					read.template deserialise<Format>(serialised);
+					measurement.record(started, std::chrono::steady_clock::now());
+				}
+				measurement.stop();
+			});
+		};
+		measureFormat.template operator()<BasicJson<std::string>>("JSON");
+		measureFormat.template operator()<BinaryFormat<>>("binary");
+	};
+	serialisation.template operator()<SmallObject>("small object");
+	serialisation.template operator()<TextObject>("text object");
+	serialisation.template operator()<NestedObject>("nested object");
+
+	// The parser converts names to lowercase in place, so it works on a copy, which is included in the time
+	auto headerScan = [&] (std::string_view client, const std::string& request, Detail::HttpScanner::Level level, std::string_view levelName) {
+		std::string name = "HTTP header parsing of a " + std::string(client) + " request (" + std::string(levelName) + ")";
+		benchmark(name, 1000000, [&] (Measurement& measurement, int64_t requests) {
+			std::string copy = request;
+			measurement.start();
+			for (int64_t i = 0; i < requests; i++) {
+				auto started = std::chrono::steady_clock::now();
+				memcpy(copy.data(), request.data(), request.size());
+				HeaderCounter parser;
+				parser.scanLevel = level;
+				parser.parse(copy);
+				measurement.record(started, std::chrono::steady_clock::now());
+			}
+			measurement.stop();
+		});
+	};
+	for (auto [client, request] : {std::pair<std::string_view, const std::string*>("browser", &browserRequest), {"curl", &curlRequest}}) {
+		headerScan(client, *request, Detail::HttpScanner::Level::SCALAR, "scalar");
+		if (Detail::HttpScanner::detectLevel() >= Detail::HttpScanner::Level::SSE2)
+			headerScan(client, *request, Detail::HttpScanner::Level::SSE2, "SSE2");
+		if (Detail::HttpScanner::detectLevel() >= Detail::HttpScanner::Level::AVX2)
+			headerScan(client, *request, Detail::HttpScanner::Level::AVX2, "AVX2");
+	}
+
+	auto jsonRpc = [&] <int Depth> (std::string_view name, bool unixSocket = false) {
+		benchmark(name, 20000, [&] (Measurement& measurement, int64_t requests) {
+			BenchmarkApi serverApi;
+			JsonRpcServer<std::string> jsonRpcServer = {serverApi};
+			Connection<decltype(jsonRpcServer)> connection = {jsonRpcServer, unixSocket};
+			BenchmarkApi clientApi;
+			SyncNetworkClient& client = connection.client;
+			[[maybe_unused]] JsonRpcClient<> jsonRpcClient = {clientApi, client, targetAddress};
+			auto send = [&] {
+				return clientApi.sum.async(12, 35);
+			};
+			auto receive = [&] (Future<int>& future) {
+				future.get();
+			};
+			pipeline<Depth, Future<int>>(measurement, 100, send, receive);
+			measurement.start();
+			pipeline<Depth, Future<int>>(measurement, requests, send, receive);
+			measurement.stop();
+		});
+	};
+	jsonRpc.template operator()<1>("JSON-RPC call");
+	// The JSON-RPC server doesn't implement batches, pipelining the calls saves the same round trips
+	jsonRpc.template operator()<16>("JSON-RPC calls pipelined 16 deep");
+	jsonRpc.template operator()<1>("JSON-RPC call over a Unix socket", true);
+
+	auto binaryRpc = [&] <int Depth> (std::string_view name, bool unixSocket = false) {
+		benchmark(name, 100000, [&] (Measurement& measurement, int64_t requests) {
+			BenchmarkApi serverApi;
+			BinaryProtocolServer<> binaryServer = {serverApi};
+			Connection<decltype(binaryServer)> connection = {binaryServer, unixSocket};
+			BenchmarkApi clientApi;
+			SyncNetworkClient& client = connection.client;
+			[[maybe_unused]] BinaryProtocolClient<> binaryClient = {clientApi, client};
+			auto send = [&] {
+				return clientApi.sum.async(12, 35);
+			};
+			auto receive = [&] (Future<int>& future) {
+				future.get();
+			};
+			pipeline<Depth, Future<int>>(measurement, 100, send, receive);
+			measurement.start();
+			pipeline<Depth, Future<int>>(measurement, requests, send, receive);
+			measurement.stop();
+		});
+	};
+	binaryRpc.template operator()<1>("binary RPC call");
+	binaryRpc.template operator()<16>("binary RPC calls pipelined 16 deep");
+	binaryRpc.template operator()<128>("binary RPC calls pipelined 128 deep");
+	binaryRpc.template operator()<1>("binary RPC call over a Unix socket", true);
+
+	// The same calls without sockets, to see what the networking costs
+	auto loopbackRpc = [&] <typename Server, typename Client> (std::string_view name, int64_t requests, auto... clientArguments) {
+		benchmark(name, requests, [&] (Measurement& measurement, int64_t requests) {
+			BenchmarkApi serverApi;
+			Server rpcServer = {serverApi};
+			LoopbackClient<Server> client = {rpcServer};
+			BenchmarkApi clientApi;
+			[[maybe_unused]] Client rpcClient = {clientApi, client, clientArguments...};
+			auto send = [&] {
+				return clientApi.sum.async(12, 35);
+			};
+			auto receive = [&] (Future<int>& future) {
+				future.get();
+			};
+			pipeline<1, Future<int>>(measurement, 100, send, receive);
+			measurement.start();
+			pipeline<1, Future<int>>(measurement, requests, send, receive);
+			measurement.stop();
+		});
+	};
+	loopbackRpc.template operator()<JsonRpcServer<std::string>, JsonRpcClient<>>("JSON-RPC call in process", 200000, targetAddress);
+	loopbackRpc.template operator()<BinaryProtocolServer<>, BinaryProtocolClient<>>("binary RPC call in process", 1000000);
+
+	// The server runs in another thread, as it would in another process, spinning a while before sleeping
+	benchmark("binary RPC call over shared memory", 200000, [&] (Measurement& measurement, int64_t requests) {
+		BenchmarkApi serverApi;
+		BinaryProtocolServer<> binaryServer = {serverApi};
+		std::string path = "/dev/shm/bomba_benchmark";
+		SharedMemoryServer<decltype(binaryServer)> server = {binaryServer, path};
+		std::jthread serverThread([&] {
+			server.run();
+		});
+		{
+			SharedMemoryClient client = {path};
+			BenchmarkApi clientApi;
+			[[maybe_unused]] BinaryProtocolClient<> binaryClient = {clientApi, client};
+			auto send = [&] {
+				return clientApi.sum.async(12, 35);
+			};
+			auto receive = [&] (Future<int>& future) {
+				future.get();
+			};
+			pipeline<1, Future<int>>(measurement, 100, send, receive);
+			measurement.start();
+			pipeline<1, Future<int>>(measurement, requests, send, receive);
+			measurement.stop();
+		}
+		server.stopRunning();
+	});
+
+	// Pipelined requests are sent together and their responses received together
+	auto udpRpc = [&] <int Depth> (std::string_view name) {
+		benchmark(name, 100000, [&] (Measurement& measurement, int64_t requests) {
+			BenchmarkApi serverApi;
+			BinaryProtocolServer<> binaryServer = {serverApi};
+			UdpServer<decltype(binaryServer)> server = {binaryServer, port};
+			std::jthread serverThread([&] {
+				server.run();
+			});
+			{
+				UdpClient client = {targetAddress, targetPort};
+				BenchmarkApi clientApi;
+				[[maybe_unused]] BinaryProtocolClient<> binaryClient = {clientApi, client};
+				auto send = [&] {
+					return clientApi.sum.async(12, 35);
+				};
+				auto receive = [&] (Future<int>& future) {
+					future.get();
+				};
+				pipeline<Depth, Future<int>>(measurement, 100, send, receive);
+				measurement.start();
+				pipeline<Depth, Future<int>>(measurement, requests, send, receive);
+				measurement.stop();
+			}
+			server.stopRunning();
+		});
+	};
+	udpRpc.template operator()<1>("binary RPC call over UDP");
+	udpRpc.template operator()<16>("binary RPC calls over UDP pipelined 16 deep");
+
+	std::filesystem::path folder = std::filesystem::temp_directory_path() / "bomba_benchmark";
+	std::filesystem::create_directories(folder);
+	{
+		std::ofstream page(folder / "index.html");
+		page << "<!DOCTYPE html>\n<html><body>" << std::string(1024, '.') << "</body></html>\n";
+	}
+	auto httpGet = [&] <int Depth> (std::string_view name) {
+		benchmark(name, 100000, [&] (Measurement& measurement, int64_t requests) {
+			CachingFileServer fileServer = {folder};
+			HttpServer<> httpServer = {fileServer};
+			BackgroundTcpServer<decltype(httpServer)> server = {httpServer, port};
+			SyncNetworkClient client = {targetAddress, targetPort};
+			HttpClient<> httpClient = {client, targetAddress};
+			auto send = [&] {
+				return httpClient.get("/index.html");
+			};
+			auto receive = [&] (RequestToken token) {
+				httpClient.getResponse(token, [] (std::span<char>, bool) {
+					return true;
+				});
+			};
+			pipeline<Depth, RequestToken>(measurement, 100, send, receive);
+			measurement.start();
+			pipeline<Depth, RequestToken>(measurement, requests, send, receive);
+			measurement.stop();
+		});
+	};
+	httpGet.template operator()<1>("HTTP GET of a cached file");
+	httpGet.template operator()<16>("HTTP GET of a cached file pipelined 16 deep");
+	httpGet.template operator()<128>("HTTP GET of a cached file pipelined 128 deep");
+
+	// Servers with more threads or shards are given twice as many clients, each keeping 16 requests in flight
+	int maxThreads = std::min(16, int(std::thread::hardware_concurrency()));
+	auto clientsFor = [] (int threads) {
+		return std::max(4, threads * 2);
+	};
+	auto scalingName = [&] (std::string_view workload, int threads, std::string_view parallelism) {
+		return std::string(workload) + " from " + std::to_string(clientsFor(threads)) + " clients with " + std::to_string(threads)
+				+ " " + std::string(parallelism) + (threads > 1 ? "s" : "");
+	};
+	for (int threads = 1; threads <= maxThreads; threads *= 2) {
+		benchmark(scalingName("HTTP GET of a cached file", threads, "thread"), 160000, [&] (Measurement& measurement, int64_t requests) {
+			CachingFileServer fileServer = {folder};
+			HttpServer<> httpServer = {fileServer};
+			BackgroundTcpServer<decltype(httpServer)> server = {httpServer, port, threads};
+			concurrently(measurement, requests, clientsFor(threads), [&] (int64_t clientRequests, auto waitForStart) {
+				SyncNetworkClient client = {targetAddress, targetPort};
+				HttpClient<> httpClient = {client, targetAddress};
+				auto send = [&] {
+					return httpClient.get("/index.html");
+				};
+				auto receive = [&] (RequestToken token) {
+					httpClient.getResponse(token, [] (std::span<char>, bool) {
+						return true;
+					});
+				};
+				pipeline<16, RequestToken>(measurement, 100, send, receive);
+				waitForStart();
+				pipeline<16, RequestToken>(measurement, clientRequests, send, receive);
+			});
+		});
+	}
+	std::filesystem::remove_all(folder);
+
+	// The same workload against each backend, the server's type selects it
+	auto binaryRpcScaling = [&] <template <typename> typename Server> (std::string_view parallelism) {
+		for (int threads = 1; threads <= maxThreads; threads *= 2) {
+			benchmark(scalingName("binary RPC calls", threads, parallelism), 320000, [&] (Measurement& measurement, int64_t requests) {
+				BenchmarkApi serverApi;
+				BinaryProtocolServer<> binaryServer = {serverApi};
+				BackgroundTcpServer<decltype(binaryServer), Server> server = {binaryServer, port, threads};
+				concurrently(measurement, requests, clientsFor(threads), [&] (int64_t clientRequests, auto waitForStart) {
+					SyncNetworkClient client = {targetAddress, targetPort};
+					BenchmarkApi clientApi;
+					[[maybe_unused]] BinaryProtocolClient<> binaryClient = {clientApi, client};
+					auto send = [&] {
+						return clientApi.sum.async(12, 35);
+					};
+					auto receive = [&] (Future<int>& future) {
+						future.get();
+					};
+					pipeline<16, Future<int>>(measurement, 100, send, receive);
+					waitForStart();
+					pipeline<16, Future<int>>(measurement, clientRequests, send, receive);
+				});
+			});
+		}
+	};
+	binaryRpcScaling.template operator()<TcpServer>("thread");
+	binaryRpcScaling.template operator()<ShardedTcpServer>("shard");
+	binaryRpcScaling.template operator()<ShardedIoUringTcpServer>("io_uring shard");
+
+	benchmark("HTTP POST of 64 kiB", 5000, [&] (Measurement& measurement, int64_t requests) {
+		PostMethod serverMethod;
+		DummyGetResponder getResponder;
+		HtmlPostResponder<> postResponder = {serverMethod};
+		HttpServer<> httpServer = {getResponder, postResponder};
+		BackgroundTcpServer<decltype(httpServer)> server = {httpServer, port};
+		SyncNetworkClient client = {targetAddress, targetPort};
+		HttpClient<> httpClient = {client, targetAddress};
+		PostMethod clientMethod;
+		clientMethod.setResponder(httpClient);
+		std::string message(65536, 'x');
+		for (int i = 0; i < 10; i++)
+			clientMethod(message);
+		measurement.start();
+		for (int64_t i = 0; i < requests; i++) {
+			auto sent = std::chrono::steady_clock::now();
+			clientMethod(message);
+			measurement.record(sent, std::chrono::steady_clock::now());
+		}
+		measurement.stop();
+	});
+	} // Finishes the JSON
+	std::cout << results << std::endl;
+}
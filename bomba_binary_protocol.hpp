@@ -106,7 +106,7 @@ struct BinaryFormat {
 		}
 		std::string_view readString(Flags flags) final override {
 			auto length = readSize(flags);
-			if (_position + length > _contents.size()) [[unlikely]] {
+			if (_position + length > std::ssize(_contents)) [[unlikely]] {
 				parseError("Incomplete request");
 				good = false;
 				return "";
@@ -137,7 +137,7 @@ struct BinaryFormat {
 		}
 		bool nextArrayElement(Flags) final override {
 			_sizes[_depth]--;
-			return (_sizes[_depth] > 0);
+			return (_sizes[_depth] >= 0);
 		}
 		void endReadingArray(Flags) final override {
 			_sizes[_depth] = -1;
@@ -243,10 +243,16 @@ template <typename SizeType = uint16_t, std::derived_from<GeneralisedBuffer> Exp
 		  BinaryIntegerFormat<ExpandingBufferType> NumWriter = LittleEndianNumberFormat<ExpandingBufferType>, int MaxDepth = 3>
 class BinaryProtocolServer {
 	IRemoteCallable& callable;
+	IRpcCallObserver* observer = nullptr;
 
 public:
 	BinaryProtocolServer(IRemoteCallable& callable) : callable(callable) {}
 
+	// The observer is notified about every call, none is set by default
+	void setCallObserver(IRpcCallObserver* newObserver) {
+		observer = newObserver;
+	}
+
 	class Session : public ITcpResponder {
 		BinaryProtocolServer& parent;
 		Session(BinaryProtocolServer& parent) : parent(parent) {}
@@ -263,7 +269,7 @@ public:
 
 			int messageId = in.readInt(SerialisationFlags::UINT_32);
 			int inputSize = in.readInt(SerialisationFlags::typeToFlags(SizeType())); // We don't need the size
-			if (input.size() < inputSize)
+			if (std::ssize(input) < inputSize)
 				return {ServerReaction::READ_ON, 0};
 
 			const IRemoteCallable* target = &parent.callable;
@@ -279,9 +285,13 @@ public:
 			auto sizePosition = outputBuffer.size();
 			out.writeInt(SerialisationFlags::typeToFlags(SizeType()), 0);
 
-			target->call(&in, out, [&] {}, [&] (std::string_view problem) {
-				out.writeString(SerialisationFlags::typeToFlags(SizeType()), problem);
-			});
+			{
+				RpcCallTimer timer(parent.observer, target);
+				target->call(&in, out, [&] {}, [&] (std::string_view problem) {
+					RpcCallTimer::failed();
+					out.writeString(SerialisationFlags::typeToFlags(SizeType()), problem);
+				});
+			}
 			SizeType outputSize = outputBuffer.size();
 			memcpy(&std::span<char>(outputBuffer)[sizePosition], &outputSize, sizeof(outputSize));
 
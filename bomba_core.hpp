@@ -3,14 +3,32 @@
 #include <optional>
 #include <array>
 #include <string_view>
+#include <string>
 #include <span>
 #include <tuple>
 #include <cstring>
+#include <atomic>
+#include <chrono>
+#include <exception>
 
 #ifndef BOMBA_ALTERNATIVE_ERROR_HANDLING
 #include <stdexcept>
 #endif
 
+// Stages of request processing are traced only if BOMBA_TRACING is defined, otherwise the macros expand to nothing
+#ifdef BOMBA_TRACING
+#include "bomba_tracing.hpp"
+#define BOMBA_TRACE_CONCATENATE_INNER(first, second) first##second
+#define BOMBA_TRACE_CONCATENATE(first, second) BOMBA_TRACE_CONCATENATE_INNER(first, second)
+#define BOMBA_TRACE_SCOPE(name) ::Bomba::TraceScope BOMBA_TRACE_CONCATENATE(bombaTraceScope, __LINE__)(name)
+#define BOMBA_TRACE_BEGIN(name) ::Bomba::traceEvent(name, false)
+#define BOMBA_TRACE_END(name) ::Bomba::traceEvent(name, true)
+#else
+#define BOMBA_TRACE_SCOPE(name)
+#define BOMBA_TRACE_BEGIN(name)
+#define BOMBA_TRACE_END(name)
+#endif
+
 namespace Bomba {
 
 #ifndef BOMBA_ALTERNATIVE_ERROR_HANDLING
@@ -93,7 +111,8 @@ auto makeRaiiContainer(Resource&& resource, Destruction&& destruction) {
 struct Float16Placeholder {
 	uint16_t data;
 	Float16Placeholder& operator=(float value) {
-		uint32_t asInt = reinterpret_cast<uint32_t&>(value);
+		uint32_t asInt = 0;
+		memcpy(&asInt, &value, sizeof(asInt));
 		data = ((asInt >> 16) & 0x8000) | ((((asInt & 0x7f800000) - 0x38000000) >> 13 ) & 0x7c00) | ((asInt >> 13) & 0x03ff);
 		return *this;
 	}
@@ -533,6 +552,9 @@ v.resize(0);
 { std::span<char>{ v.begin(), v.end() - 1 } };
 };
 
+// How many times any ExpandingBuffer outgrew its static part and had to allocate, counted only on that slow path
+inline std::atomic<int64_t> expandingBufferHeapFallbacks = 0;
+
 template <int StaticSize = 1024, CharVectorType Vector = std::string>
 class ExpandingBuffer : public GeneralisedBuffer {
 	std::array<char, StaticSize> _basic;
@@ -540,6 +562,7 @@ class ExpandingBuffer : public GeneralisedBuffer {
 
 	bool bufferFull() override {
 		if (_extended.empty()) {
+			expandingBufferHeapFallbacks.fetch_add(1, std::memory_order_relaxed);
 			_extended.resize(3 * StaticSize);
 			memcpy(_extended.data(), _basic.data(), StaticSize);
 			moveBuffer({&_extended[StaticSize], 2 * StaticSize});
@@ -641,7 +664,6 @@ struct ISerialisable {
 	void serialise(FromType& output) {
 		typename F::Output format(output);
 		serialiseInternal(format);
-		return output;
 	}
 	
 	template <DataFormat F, typename FromType>
@@ -806,6 +828,7 @@ public:
 template <StringLiteral Separator, BetterAssembledString StringType = std::string>
 struct PathWithSeparator {
 	static const IRemoteCallable* findCallable(std::string_view path, const IRemoteCallable* root) {
+		BOMBA_TRACE_SCOPE("method lookup");
 		auto start = path.begin();
 		const IRemoteCallable* current = root;
 		while (start < path.end()) {
@@ -851,6 +874,92 @@ private:
 	}
 };
 
+// How long the stages of a remote procedure call took, a callable that doesn't report the stages has all its time
+// counted as execution
+struct RpcCallMeasurement {
+	std::chrono::nanoseconds parsing = {}; // Reading the arguments
+	std::chrono::nanoseconds execution = {};
+	std::chrono::nanoseconds serialisation = {}; // Writing the result
+	bool failed = false;
+};
+
+struct IRpcCallObserver {
+	// Implementing this interface allows gathering statistics about calls of methods, servers can be given one optionally
+
+	// Called after each call of a method, possibly from multiple threads at once
+	virtual void recordCall(const IRemoteCallable* method, const RpcCallMeasurement& measurement) = 0;
+};
+
+// Statistics of one method, the durations are sums over all calls
+struct RpcMethodStatistics {
+	std::string path; // Names separated by dots, as in JSON-RPC
+	int64_t calls = 0;
+	int64_t errors = 0;
+	std::chrono::nanoseconds parsing = {};
+	std::chrono::nanoseconds execution = {};
+	std::chrono::nanoseconds serialisation = {};
+};
+
+// Measures a call if there is an observer, callables report when they finish reading arguments and executing the call
+// through the static methods, which do nothing if the call isn't measured
+class RpcCallTimer {
+	using Clock = std::chrono::steady_clock;
+	IRpcCallObserver* _observer = nullptr;
+	const IRemoteCallable* _method = nullptr;
+	RpcCallTimer* _outer = nullptr;
+	Clock::time_point _start = {};
+	Clock::time_point _parsed = {};
+	Clock::time_point _executed = {};
+	int _exceptions = 0;
+	bool _failed = false;
+	inline static thread_local RpcCallTimer* _current = nullptr;
+
+public:
+	RpcCallTimer(IRpcCallObserver* observer, const IRemoteCallable* method) : _observer(observer), _method(method) {
+		if (!_observer) [[likely]]
+			return;
+		_outer = _current;
+		_current = this;
+		_exceptions = std::uncaught_exceptions();
+		_start = Clock::now();
+	}
+	RpcCallTimer(const RpcCallTimer&) = delete;
+	void operator=(const RpcCallTimer&) = delete;
+
+	~RpcCallTimer() {
+		if (!_observer) [[likely]]
+			return;
+		Clock::time_point end = Clock::now();
+		_current = _outer;
+		if (_parsed == Clock::time_point{})
+			_parsed = _start;
+		if (_executed == Clock::time_point{})
+			_executed = end;
+		_observer->recordCall(_method, { _parsed - _start, _executed - _parsed, end - _executed,
+				_failed || std::uncaught_exceptions() > _exceptions });
+	}
+
+	void fail() {
+		_failed = true;
+	}
+
+	static void argumentsParsed() {
+		if (_current) [[unlikely]]
+			_current->_parsed = Clock::now();
+	}
+
+	static void executed() {
+		if (_current) [[unlikely]]
+			_current->_executed = Clock::now();
+	}
+
+	// For callables that report errors without throwing
+	static void failed() {
+		if (_current) [[unlikely]]
+			_current->_failed = true;
+	}
+};
+
 enum class ServerReaction {
 	OK,
 	READ_ON,
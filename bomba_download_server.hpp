@@ -21,10 +21,20 @@
 
 namespace Bomba {
 
+// Allows looking up paths received as std::string_view without creating temporary std::string instances
+struct FilePathHash {
+	using is_transparent = void;
+	size_t operator()(std::string_view path) const {
+		return std::hash<std::string_view>()(path);
+	}
+};
+template <typename Value>
+using FilePathMap = std::unordered_map<std::string, Value, FilePathHash, std::equal_to<>>;
+
 class FileServerBase : public IHttpGetResponder {
 	std::vector<std::function<void()>> _modifiers;
 protected:
-	std::unordered_map<std::string, std::string> _extensions;
+	FilePathMap<std::string> _extensions;
 	std::filesystem::path _root;
 
 	FileServerBase(const std::filesystem::path& path) : _root(path) {
@@ -44,12 +54,15 @@ protected:
 		_extensions[".xml"] = "application/xml";
 	}
 
-	std::string extensionDescription(std::string_view extension) {
-		auto foundExtension = _extensions.find(std::string(extension));
+	// The improvised description is written into the spare string if the extension is unknown
+	std::string_view extensionDescription(std::string_view extension, std::string& improvised) const {
+		auto foundExtension = _extensions.find(extension);
 		if (foundExtension != _extensions.end()) {
 			return foundExtension->second;
 		} else {
-			return "application/" + std::string(extension.substr(1)); // Improvise if unknown
+			improvised = "application/";
+			improvised += extension.substr(1); // Improvise if unknown
+			return improvised;
 		}
 	}
 
@@ -76,7 +89,7 @@ private:
 		FileProviderType provider;
 		bool allKnownAtOnce = false;
 	};
-	std::unordered_map<std::string, GeneratedFileEntry> _generatedFiles;
+	FilePathMap<GeneratedFileEntry> _generatedFiles;
 
 public:
 	DynamicFileServer(const std::filesystem::path& path) : FileServerBase(path) {}
@@ -86,17 +99,18 @@ public:
 	}
 
 	bool get(std::string_view path, IWriteStarter& outputProvider) {
-		auto foundGenerated = _generatedFiles.find(std::string(path));
+		auto foundGenerated = _generatedFiles.find(path);
 		if (foundGenerated != _generatedFiles.end()) {
 			std::string_view extension = path.substr(path.find_last_of('.'));
+			std::string improvised;
 			if (foundGenerated->second.allKnownAtOnce) {
 				foundGenerated->second.provider([&] (std::span<const char> chunk) {
-					outputProvider.writeKnownSize(extensionDescription(extension), chunk.size(), [&] (GeneralisedBuffer& buffer) {
+					outputProvider.writeKnownSize(extensionDescription(extension, improvised), chunk.size(), [&] (GeneralisedBuffer& buffer) {
 						buffer += chunk;
 					});
 				});
 			} else {
-				outputProvider.writeUnknownSize(extensionDescription(extension), [&] (GeneralisedBuffer& buffer) {
+				outputProvider.writeUnknownSize(extensionDescription(extension, improvised), [&] (GeneralisedBuffer& buffer) {
 					foundGenerated->second.provider([&] (std::span<const char> chunk) {
 						buffer += chunk;
 					});
@@ -125,7 +139,8 @@ public:
 		uintmax_t size = std::filesystem::file_size(fullPath);
 
 		std::ifstream file(fullPath);
-		outputProvider.writeKnownSize(extensionDescription(fullPath.extension().string()), size, [&] (GeneralisedBuffer& output) {
+		std::string improvised;
+		outputProvider.writeKnownSize(extensionDescription(fullPath.extension().string(), improvised), size, [&] (GeneralisedBuffer& output) {
 			uintmax_t position = 0;
 			while (position < size) {
 				std::array<char, 4096> buffer;
@@ -149,10 +164,11 @@ class CachingFileServer : public FileServerBase {
 			std::string extension = path.extension().string();
 			for (char& c : extension)
 				c = std::tolower(c);
-			type = parent->extensionDescription(extension);
+			std::string improvised;
+			type = parent->extensionDescription(extension, improvised);
 		}
 	};
-	std::unordered_map<std::string, CachedFile> _cache;
+	FilePathMap<CachedFile> _cache;
 	std::vector<std::string> _fileNames;
 	std::shared_mutex _mutex;
 
@@ -196,7 +212,7 @@ public:
 
 	bool get(std::string_view path, IWriteStarter& outputProvider) {
 		std::shared_lock lock(_mutex);
-		auto found = _cache.find(std::string(path));
+		auto found = _cache.find(path);
 		if (found == _cache.end()) [[unlikely]] {
 			std::cout << "No such file " << path << std::endl;
 			return false;
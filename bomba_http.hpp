@@ -5,6 +5,12 @@
 #include "bomba_core.hpp"
 #endif
 #include <charconv>
+#include <algorithm>
+#include <bit>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BOMBA_HTTP_SIMD
+#include <immintrin.h>
+#endif
 
 // Good HTTP protocol description: https://www3.ntu.edu.sg/home/ehchua/programming/webprogramming/HTTP_Basics.html
 // Good testing site: http://www.ptsv2.com/
@@ -12,40 +18,171 @@
 namespace Bomba {
 
 namespace Detail {
+
+// Finds the characters that delimit parts of HTTP headers many bytes at a time, using instructions the CPU has
+// (checked on first use)
+namespace HttpScanner {
+enum class Level {
+	SCALAR,
+	SSE2, // 16 bytes at a time
+	AVX2, // 32 bytes at a time
+};
+
+inline Level detectLevel() {
+#ifdef BOMBA_HTTP_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return Level::AVX2;
+	return Level::SSE2;
+#else
+	return Level::SCALAR;
+#endif
+}
+
+// AVX2 is not used by default because it's slower on typical header lines, which are rarely longer than two of its blocks
+inline Level defaultLevel() {
+	static const Level level = std::min(detectLevel(), Level::SSE2);
+	return level;
+}
+
+inline bool isNameEnd(char letter) {
+	return letter == ' ' || letter == '\t' || letter == ':';
+}
+
+inline int findCarriageReturnScalar(const char* data, int position, int size) {
+	while (position < size && data[position] != '\r')
+		position++;
+	return position;
+}
+
+// Also converts the name to lowercase
+inline int findNameEndScalar(char* data, int position, int size) {
+	while (position < size && !isNameEnd(data[position])) {
+		if (data[position] <= 'Z' && data[position] >= 'A')
+			data[position] += 'a' - 'A';
+		position++;
+	}
+	return position;
+}
+
+#ifdef BOMBA_HTTP_SIMD
+inline int findCarriageReturnSse2(const char* data, int position, int size) {
+	const __m128i carriageReturn = _mm_set1_epi8('\r');
+	for (; position + 16 <= size; position += 16) {
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + position));
+		unsigned int found = _mm_movemask_epi8(_mm_cmpeq_epi8(block, carriageReturn));
+		if (found)
+			return position + std::countr_zero(found);
+	}
+	return findCarriageReturnScalar(data, position, size);
+}
+
+inline int findNameEndSse2(char* data, int position, int size) {
+	const __m128i indexes = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	for (; position + 16 <= size; position += 16) {
+		__m128i* address = reinterpret_cast<__m128i*>(data + position);
+		__m128i block = _mm_loadu_si128(address);
+		__m128i ends = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')),
+				_mm_cmpeq_epi8(block, _mm_set1_epi8('\t'))), _mm_cmpeq_epi8(block, _mm_set1_epi8(':')));
+		unsigned int found = _mm_movemask_epi8(ends);
+		int end = found ? std::countr_zero(found) : 16;
+		// Letters before the end are converted, the rest is written back unchanged
+		__m128i uppercase = _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('A' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), block));
+		__m128i converted = _mm_and_si128(uppercase, _mm_cmpgt_epi8(_mm_set1_epi8(end), indexes));
+		_mm_storeu_si128(address, _mm_or_si128(block, _mm_and_si128(converted, _mm_set1_epi8('a' - 'A'))));
+		if (found)
+			return position + end;
+	}
+	return findNameEndScalar(data, position, size);
+}
+
+__attribute__((target("avx2"))) inline int findCarriageReturnAvx2(const char* data, int position, int size) {
+	const __m256i carriageReturn = _mm256_set1_epi8('\r');
+	for (; position + 32 <= size; position += 32) {
+		__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + position));
+		unsigned int found = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, carriageReturn));
+		if (found)
+			return position + std::countr_zero(found);
+	}
+	return findCarriageReturnSse2(data, position, size);
+}
+
+__attribute__((target("avx2"))) inline int findNameEndAvx2(char* data, int position, int size) {
+	const __m256i indexes = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+			16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+	for (; position + 32 <= size; position += 32) {
+		__m256i* address = reinterpret_cast<__m256i*>(data + position);
+		__m256i block = _mm256_loadu_si256(address);
+		__m256i ends = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(' ')),
+				_mm256_cmpeq_epi8(block, _mm256_set1_epi8('\t'))), _mm256_cmpeq_epi8(block, _mm256_set1_epi8(':')));
+		unsigned int found = _mm256_movemask_epi8(ends);
+		int end = found ? std::countr_zero(found) : 32;
+		__m256i uppercase = _mm256_and_si256(_mm256_cmpgt_epi8(block, _mm256_set1_epi8('A' - 1)),
+				_mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), block));
+		__m256i converted = _mm256_and_si256(uppercase, _mm256_cmpgt_epi8(_mm256_set1_epi8(end), indexes));
+		_mm256_storeu_si256(address, _mm256_or_si256(block, _mm256_and_si256(converted, _mm256_set1_epi8('a' - 'A'))));
+		if (found)
+			return position + end;
+	}
+	return findNameEndSse2(data, position, size);
+}
+#endif
+
+// Returns the position of the first \r at or after the position, or the size if there is none
+inline int findCarriageReturn(const char* data, int position, int size, Level level = defaultLevel()) {
+#ifdef BOMBA_HTTP_SIMD
+	if (level == Level::SSE2) [[likely]]
+		return findCarriageReturnSse2(data, position, size);
+	if (level == Level::AVX2)
+		return findCarriageReturnAvx2(data, position, size);
+#endif
+	return findCarriageReturnScalar(data, position, size);
+}
+
+// Returns the position of the first space, tab or colon at or after the position, or the size if there is none,
+// converting the letters before it to lowercase
+inline int findNameEnd(char* data, int position, int size, Level level = defaultLevel()) {
+#ifdef BOMBA_HTTP_SIMD
+	if (level == Level::SSE2) [[likely]]
+		return findNameEndSse2(data, position, size);
+	if (level == Level::AVX2)
+		return findNameEndAvx2(data, position, size);
+#endif
+	return findNameEndScalar(data, position, size);
+}
+} // namespace HttpScanner
+
+// Can be given the input again with more data appended when the header is incomplete, parsing continues where it stopped
 struct HttpParseState {
-	int parsePosition = 0;
+	int parsePosition = 0; // Start of the first line that was not processed yet, or the body once the header is complete
+	int scannedUntil = 0; // There is no carriage return between the start of the unprocessed line and this position
 	int bodySize = -1;
+	bool headerComplete = false;
+	HttpScanner::Level scanLevel = HttpScanner::defaultLevel(); // Can be changed to compare the implementations
 
 	void reset() {
 		parsePosition = 0;
+		scannedUntil = 0;
 		bodySize = -1;
+		headerComplete = false;
 	}
 
 	std::pair<ServerReaction, int64_t> parse(std::span<char> input) {
+		BOMBA_TRACE_SCOPE("HTTP header parse");
 		int position = parsePosition;
 
 		if (position == 0) { // Header not read yet
-			while (position < std::ssize(input)) {
-				if (input[position] == '\r') [[unlikely]] {
-
-					if (!firstLineReader({input.data(), size_t(position)})) {
-						return {ServerReaction::DISCONNECT, 0};
-					}
-
-					position++;
-					if (position >= std::ssize(input))
-						break;
-					if (input[position] != '\n')
-						return {ServerReaction::DISCONNECT, 0};
-					break;
-				}
-				position++;
-			}
-
-			if (position == std::ssize(input)) {
+			position = HttpScanner::findCarriageReturn(input.data(), std::max(position, scannedUntil), input.size(), scanLevel);
+			scannedUntil = position;
+			if (position + 1 >= std::ssize(input)) {
 				return {ServerReaction::READ_ON, position - 1};
 			}
-			position++;
+			if (input[position + 1] != '\n')
+				return {ServerReaction::DISCONNECT, 0};
+			if (!firstLineReader({input.data(), size_t(position)})) {
+				return {ServerReaction::DISCONNECT, 0};
+			}
+			position += 2;
 			parsePosition = position;
 		}
 
@@ -72,18 +209,11 @@ struct HttpParseState {
 			}
 
 			// Go through the attribute name
-			while (position < std::ssize(input)) {
-				if (input[position] == ' ' || input[position] == '\t' || input[position] == ':') {
-					attributeName = std::string_view(input.data() + attributeNameStart, position - attributeNameStart);
-					break;
-				}
-				if (input[position] <= 'Z' && input[position] >= 'A')
-					input[position] += 'a' - 'A';
-				position++;
-			}
+			position = HttpScanner::findNameEnd(input.data(), position, input.size(), scanLevel);
 			if (position >= std::ssize(input)) {
 				return {ServerReaction::READ_ON, position - 1};
 			}
+			attributeName = std::string_view(input.data() + attributeNameStart, position - attributeNameStart);
 
 			// Find the value
 			bool colonFound = false;
@@ -103,17 +233,13 @@ struct HttpParseState {
 				return {ServerReaction::DISCONNECT, 0};
 			}
 
-			// Find the end of the attribute
-			while (position < std::ssize(input)) {
-				if (input[position] == '\r') {
-					attributeValue = std::string_view(input.data() + attributeValueStart, position - attributeValueStart);
-					break;
-				}
-				position++;
-			}
+			// Find the end of the attribute, long values arriving in many parts are not scanned again
+			position = HttpScanner::findCarriageReturn(input.data(), std::max(position, scannedUntil), input.size(), scanLevel);
+			scannedUntil = position;
 			if (position >= std::ssize(input)) {
 				return {ServerReaction::READ_ON, position - 1};
 			}
+			attributeValue = std::string_view(input.data() + attributeValueStart, position - attributeValueStart);
 
 			// Use the data
 			if (attributeName == "content-length") {
@@ -135,6 +261,7 @@ struct HttpParseState {
 		if (input[parsePosition + 1] != '\n')
 			return {ServerReaction::DISCONNECT, 0};
 		parsePosition += 2; // Skip the last \r\n, get to content
+		headerComplete = true;
 
 		return { ServerReaction::OK, parsePosition };
 	}
@@ -142,6 +269,133 @@ struct HttpParseState {
 	virtual bool firstLineReader(std::string_view firstLine) = 0;
 	virtual void headerReader(std::string_view property, std::string_view value, std::pair<int, int> location) = 0;
 };
+
+// Locates the chunks of a body sent with chunked transfer encoding, can be given the input again with more data appended
+struct HttpChunkedBody {
+	int scanPosition = 0; // Start of the first chunk (or trailer line) that was not entirely received yet
+	int dataSize = 0; // Size of the data in the chunks before scanPosition
+	bool inTrailer = false;
+
+	// Returns OK if the whole body is present, ending at scanPosition
+	ServerReaction scan(std::span<const char> input, int bodyStart) {
+		scanPosition = std::max(scanPosition, bodyStart);
+		while (true) {
+			int lineEnd = HttpScanner::findCarriageReturn(input.data(), scanPosition, input.size());
+			if (lineEnd + 1 >= std::ssize(input))
+				return ServerReaction::READ_ON;
+			if (input[lineEnd + 1] != '\n') [[unlikely]]
+				return ServerReaction::DISCONNECT;
+			if (inTrailer) {
+				bool last = (lineEnd == scanPosition);
+				scanPosition = lineEnd + 2;
+				if (last)
+					return ServerReaction::OK;
+				continue;
+			}
+
+			// Chunk extensions after the size are ignored
+			int chunkSize = 0;
+			auto [end, error] = std::from_chars(input.data() + scanPosition, input.data() + lineEnd, chunkSize, 16);
+			if (error != std::errc() || chunkSize < 0) [[unlikely]]
+				return ServerReaction::DISCONNECT;
+			if (chunkSize == 0) {
+				inTrailer = true;
+				scanPosition = lineEnd + 2;
+				continue;
+			}
+			int64_t chunkEnd = int64_t(lineEnd) + 2 + chunkSize + 2;
+			if (chunkEnd > std::ssize(input))
+				return ServerReaction::READ_ON;
+			if (input[chunkEnd - 2] != '\r' || input[chunkEnd - 1] != '\n') [[unlikely]]
+				return ServerReaction::DISCONNECT;
+			dataSize += chunkSize;
+			scanPosition = chunkEnd;
+		}
+	}
+
+	// Moves the data of all chunks together to the body's start, can be used only after scan() returned OK
+	std::span<char> join(std::span<char> input, int bodyStart) {
+		int position = bodyStart;
+		char* joined = input.data() + bodyStart;
+		while (true) {
+			int lineEnd = HttpScanner::findCarriageReturn(input.data(), position, input.size());
+			int chunkSize = 0;
+			std::from_chars(input.data() + position, input.data() + lineEnd, chunkSize, 16);
+			if (chunkSize == 0)
+				break;
+			memmove(joined, input.data() + lineEnd + 2, chunkSize);
+			joined += chunkSize;
+			position = lineEnd + 2 + chunkSize + 2;
+		}
+		return {input.data() + bodyStart, size_t(dataSize)};
+	}
+};
+
+// Sends a response of unknown size with Content-Length if it fits into the buffer, otherwise sends the header
+// and continues with chunked transfer encoding, one chunk per filled buffer
+template <int ChunkSize>
+struct ChunkedStreamingBuffer : StreamingBuffer<ChunkSize> {
+	constexpr static char lengthIntro[] = "HTTP/1.1 200 OK\r\nContent-Length:";
+	constexpr static char unsetLength[] = " 0         ";
+	constexpr static std::string_view chunkedField = "Transfer-Encoding: chunked"; // Replaces Content-Length
+	constexpr static int lengthFieldStart = sizeof("HTTP/1.1 200 OK\r\n") - 1;
+	static_assert(sizeof(lengthIntro) - 1 + sizeof(unsetLength) - 1 - lengthFieldStart == chunkedField.size());
+	static_assert(ChunkSize >= 256, "The header must fit into the first chunk");
+	constexpr static std::string_view lineEnd = "\r\n";
+	constexpr static std::string_view lastChunk = "0\r\n\r\n";
+
+	Callback<void(std::span<const char>)> writer;
+	int headerSize = 0;
+	bool chunked = false;
+
+	ChunkedStreamingBuffer(Callback<void(std::span<const char>)> writer, std::string_view contentType) : writer(writer) {
+		*this += lengthIntro;
+		*this += unsetLength;
+		*this += "\r\nContent-Type: ";
+		*this += contentType;
+		*this += "\r\n\r\n";
+		headerSize = this->size();
+	}
+
+	void writeChunk(std::span<const char> data) {
+		if (data.empty())
+			return; // An empty chunk would end the body
+		std::array<char, sizeof(int) * 2 + 2> sizeLine;
+		char* end = std::to_chars(sizeLine.data(), sizeLine.data() + sizeLine.size() - 2, data.size(), 16).ptr;
+		*end++ = '\r';
+		*end++ = '\n';
+		writer({sizeLine.data(), end});
+		writer(data);
+		writer(std::span<const char>(lineEnd.data(), lineEnd.size()));
+	}
+
+	void flush() override {
+		std::span<char> unsent = {this->_basic.data(), size_t(this->size() - this->_sizeAtLastFlush)};
+		if (!chunked) {
+			if (headerSize == 0) [[unlikely]]
+				logicError("Content type too long for the HTTP response buffer");
+			chunked = true;
+			memcpy(unsent.data() + lengthFieldStart, chunkedField.data(), chunkedField.size());
+			writer(unsent.first(headerSize));
+			unsent = unsent.subspan(headerSize);
+		}
+		writeChunk(unsent);
+		this->_sizeAtLastFlush = this->size();
+	}
+
+	// Must be called after the whole response was written
+	void finish() {
+		if (!chunked) {
+			std::span<char> written = {this->_basic.data(), size_t(this->size())};
+			std::to_chars(written.data() + sizeof(lengthIntro), written.data() + sizeof(lengthIntro) + sizeof(unsetLength) - 2,
+					this->size() - headerSize);
+			writer(written);
+		} else {
+			flush();
+			writer(std::span<const char>(lastChunk.data(), lastChunk.size()));
+		}
+	}
+};
 } // namespace Detail
 
 template <AssembledString StringType = std::string>
@@ -528,9 +782,15 @@ struct DummyPostResponder : IHttpPostResponder {
 template <BetterAssembledString ResponseStringType = std::string>
 class HtmlPostResponder : public IHttpPostResponder {
 	IRemoteCallable& _callable = nullptr;
+	IRpcCallObserver* _observer = nullptr;
 public:
 	HtmlPostResponder(IRemoteCallable& callable) : _callable(callable) {}
 
+	// The observer is notified about every call, none is set by default
+	void setCallObserver(IRpcCallObserver* observer) {
+		_observer = observer;
+	}
+
 	bool post(std::string_view path, std::string_view, std::span<char> request, IWriteStarter&) override {
 		std::string_view editedPath = path.substr(1);
 		const IRemoteCallable* method = PathWithSeparator<"/", ResponseStringType>::findCallable(editedPath, &_callable);
@@ -538,7 +798,9 @@ public:
 			return false;
 		typename HtmlMessageEncoding<ResponseStringType>::Input input = {std::string_view(request.data(), request.size())};
 		NullStructredOutput nullOutput;
-		method->call(&input, nullOutput, {}, {});
+		RpcCallTimer timer(_observer, method);
+		if (!method->call(&input, nullOutput, {}, {})) [[unlikely]]
+			timer.fail();
 		return true;
 	}
 };
@@ -599,23 +861,36 @@ public:
 	}
 };
 
-template <std::derived_from<GeneralisedBuffer> ExpandingBufferType = ExpandingBuffer<1024>>
+// Responses of unknown size longer than ChunkSize are sent with chunked transfer encoding as they are written,
+// ExpandingBufferType collects them whole for HTTP/1.0 clients, which don't understand it
+template <std::derived_from<GeneralisedBuffer> ExpandingBufferType = ExpandingBuffer<1024>, int ChunkSize = 4096>
 class HttpServer {
 	struct Responders {
 		IHttpGetResponder& getResponder;
 		IHttpPostResponder& postResponder;
 	} _responders;
 
+	int _maxHeaderSize = DefaultMaxHeaderSize;
+
 	static inline DummyGetResponder dummyGetResponderInstance = {};
 	static inline DummyPostResponder dummyPostResponderInstance = {};
 public:
+	constexpr static int DefaultMaxHeaderSize = 16384;
+
 	HttpServer(IHttpGetResponder& getResponder = dummyGetResponderInstance, IHttpPostResponder& postResponder = dummyPostResponderInstance)
 			: _responders({getResponder, postResponder}) {}
+
+	// Requests with longer headers (including the first line) are refused with 431 and the connection is closed,
+	// affects only sessions created afterwards
+	void setMaxHeaderSize(int maxHeaderSize) {
+		_maxHeaderSize = maxHeaderSize;
+	}
 			
 	class Session : ITcpResponder {
 		Responders _responders;
+		int _maxHeaderSize = DefaultMaxHeaderSize;
 
-		Session(Responders responders) : _responders(responders) {}
+		Session(Responders responders, int maxHeaderSize) : _responders(responders), _maxHeaderSize(maxHeaderSize) {}
 
 		struct ParseState : Detail::HttpParseState {
 			enum RequestType {
@@ -628,6 +903,7 @@ public:
 			std::pair<int, int> path;
 			std::pair<int, int> contentType;
 			ServerReaction ending = ServerReaction::OK;
+			bool chunkingAllowed = true;
 
 			virtual bool firstLineReader(std::string_view firstLine) override {
 				int separator1 = 0;
@@ -650,6 +926,7 @@ public:
 				std::string_view protocol = firstLine.substr(separator2, firstLine.size() - separator2);
 				if (protocol != "HTTP/1.1" && protocol != "HTTP/1.0")
 					requestType = WEIRD_REQUEST;
+				chunkingAllowed = (protocol == "HTTP/1.1");
 				return true;
 			}
 			virtual void headerReader(std::string_view name, std::string_view value, std::pair<int, int> location) override {
@@ -664,6 +941,11 @@ public:
 
 		ParseState _state;
 	public:
+		// The header of an incomplete request was processed and only its body is missing
+		bool readingBody() const {
+			return _state.headerComplete;
+		}
+
 		std::pair<ServerReaction, int64_t> respond(
 					std::span<char> input, Callback<void(std::span<const char>)> writer) override {
 			auto restore = [this] () {
@@ -671,13 +953,25 @@ public:
 				_state.requestType = ParseState::UNINVESTIGATED_REQUEST;
 			};
 
-			// Locate the header's span
-			if (_state.bodySize == -1) {
+			// Locate the header's span, an incomplete header is kept parsed and only the rest is parsed when more arrives
+			if (!_state.headerComplete) {
 				auto [reaction, position] = _state.parse(input);
-				if (reaction != ServerReaction::OK) {
+				if (reaction == ServerReaction::READ_ON && std::ssize(input) <= _maxHeaderSize) [[likely]]
+					return {reaction, position};
+				if (reaction == ServerReaction::DISCONNECT) [[unlikely]] {
 					restore();
 					return {reaction, position};
 				}
+				if (reaction == ServerReaction::READ_ON || _state.parsePosition > _maxHeaderSize) [[unlikely]] {
+					constexpr std::string_view errorMessage =
+							"HTTP/1.1 431 Request Header Fields Too Large\r\n"
+							"Content-Length: 86\r\n"
+							"Connection: close\r\n\r\n"
+							"<!doctype html><html lang=en><title>Error 431: Request header fields too large</title>";
+					writer(std::span<const char>(errorMessage.begin(), errorMessage.size()));
+					restore();
+					return {ServerReaction::DISCONNECT, 0};
+				}
 			}
 
 			if (_state.requestType == ParseState::POST_REQUEST) {
@@ -701,11 +995,13 @@ public:
 
 				struct WriteStarter : IWriteStarter {
 					Callback<void(std::span<const char>)> writer;
+					bool chunkingAllowed = true;
 					bool startedResponse = false;
+					bool sentPart = false; // The response was partly sent and can't be replaced by an error response
 					int headerSize = 0;
 
 
-					WriteStarter(decltype(writer) writer) : writer(writer) {}
+					WriteStarter(decltype(writer) writer, bool chunkingAllowed) : writer(writer), chunkingAllowed(chunkingAllowed) {}
 
 					void startCorrectResponse(GeneralisedBuffer& target, std::string_view contentType, std::optional<int> size = std::nullopt) {
 						startedResponse = true;
@@ -725,6 +1021,18 @@ public:
 					}
 
 					void writeUnknownSize(std::string_view resourceType, Callback<void(GeneralisedBuffer&)> filler) override {
+						if (chunkingAllowed) [[likely]] {
+							startedResponse = true;
+							Detail::ChunkedStreamingBuffer<ChunkSize> streamingBuffer{writer, resourceType};
+							try {
+								filler(streamingBuffer);
+							} catch (...) {
+								sentPart = streamingBuffer.chunked;
+								throw;
+							}
+							streamingBuffer.finish();
+							return;
+						}
 						ExpandingBufferType expandingBuffer;
 						startCorrectResponse(expandingBuffer, resourceType);
 						filler(expandingBuffer);
@@ -741,7 +1049,7 @@ public:
 					}
 				};
 
-				WriteStarter correctResponseWriter = {writer};
+				WriteStarter correctResponseWriter = {writer, _state.chunkingAllowed};
 				std::string_view path{input.data() + _state.path.first, size_t(_state.path.second)};
 				try {
 					if (_state.requestType == ParseState::GET_REQUEST) {
@@ -766,6 +1074,11 @@ public:
 						}
 					}
 				} catch (...) {
+					if (correctResponseWriter.sentPart) [[unlikely]] {
+						// Closing the connection is the only way to tell the client that the response is incomplete
+						restore();
+						return {ServerReaction::DISCONNECT, consuming};
+					}
 					constexpr std::string_view errorMessage =
 							"HTTP/1.1 500 Internal Server Error\r\n"
 							"Content-Length: 76\r\n\r\n"
@@ -795,7 +1108,7 @@ public:
 	};
 	
 	Session getSession() {
-		Session made(_responders);
+		Session made(_responders, _maxHeaderSize);
 		return made;
 	}
 };
@@ -841,6 +1154,8 @@ class HttpClient : public IRpcResponder {
 
 	struct ParseState : Detail::HttpParseState {
 		int resultCode = 0;
+		bool chunked = false;
+		Detail::HttpChunkedBody chunks;
 
 		virtual bool firstLineReader(std::string_view firstLine) override {
 			int separator1 = 0;
@@ -853,7 +1168,10 @@ class HttpClient : public IRpcResponder {
 			std::from_chars(&firstLine[separator1], &firstLine[separator2], resultCode);
 			return true;
 		}
-		virtual void headerReader(std::string_view, std::string_view, std::pair<int, int>) override { }
+		virtual void headerReader(std::string_view name, std::string_view value, std::pair<int, int>) override {
+			if (name == "transfer-encoding" && value.ends_with("chunked"))
+				chunked = true;
+		}
 	};
 
 public:
@@ -898,13 +1216,24 @@ public:
 	}
 
 	void getResponse(RequestToken token, Callback<bool(std::span<char> message, bool success)> reader) {
+		readResponse<true>(token, reader);
+	}
+
+	// Reads the response only if it has arrived completely, returns whether it did (or the server could not be understood)
+	bool tryToGetResponse(RequestToken token, Callback<bool(std::span<char> message, bool success)> reader) {
+		return readResponse<false>(token, reader);
+	}
+
+private:
+	template <bool doWait>
+	bool readResponse(RequestToken token, Callback<bool(std::span<char> message, bool success)> reader) {
 		bool done = false;
-		while (!done) {
+		do {
 			ParseState state;
-			_client.getResponse(token, [&, this] (std::span<char> input, bool identified)
+			auto responseReader = [&, this] (std::span<char> input, bool identified)
 						-> std::tuple<ServerReaction, RequestToken, int64_t> {
 				// Locate the header's span
-				if (state.bodySize == -1) {
+				if (!state.headerComplete) {
 					auto [reaction, position] = state.parse(input);
 					if (reaction == ServerReaction::DISCONNECT) {
 						done = true;
@@ -914,25 +1243,40 @@ public:
 					}
 				}
 
-				if (state.bodySize > 0 && std::ssize(input) < state.parsePosition + state.bodySize) {
+				int consumed = state.parsePosition + std::max(0, state.bodySize);
+				if (state.chunked) {
+					ServerReaction reaction = state.chunks.scan(input, state.parsePosition);
+					if (reaction == ServerReaction::DISCONNECT) [[unlikely]]
+						done = true;
+					if (reaction != ServerReaction::OK)
+						return {reaction, RequestToken{}, input.size()};
+					consumed = state.chunks.scanPosition;
+				} else if (state.bodySize > 0 && std::ssize(input) < state.parsePosition + state.bodySize) {
 					return {ServerReaction::READ_ON, RequestToken{}, input.size()};
 				}
 			
 				if (!identified && token != RequestToken{ _lastTokenRead.id + 1}) {
-					int offset = state.parsePosition + std::max(0, state.bodySize);
 					state = ParseState{};
 					_lastTokenRead.id++;
-					return {ServerReaction::WRONG_REPLY, _lastTokenRead, offset};
+					return {ServerReaction::WRONG_REPLY, _lastTokenRead, consumed};
 				}					
 				done = true;
 
-				reader(std::span<char>(input.begin() + state.parsePosition, input.begin() + state.parsePosition + state.bodySize),
-						(state.resultCode >= 200 && state.resultCode < 300));
+				// Chunks are joined only when read, a stored response must remain parseable
+				std::span<char> body = state.chunked ? state.chunks.join(input, state.parsePosition)
+						: std::span<char>(input.begin() + state.parsePosition, input.begin() + state.parsePosition + std::max(0, state.bodySize));
+				reader(body, (state.resultCode >= 200 && state.resultCode < 300));
 				if (!identified)
 					_lastTokenRead.id++;
-				return {ServerReaction::OK, _lastTokenRead, state.parsePosition + std::max(0, state.bodySize)};
-			});
-		}
+				state = ParseState{}; // Responses received in the same chunk are parsed next and stored
+				return {ServerReaction::OK, _lastTokenRead, consumed};
+			};
+			if constexpr(doWait)
+				_client.getResponse(token, responseReader);
+			else
+				_client.tryToGetResponse(token, responseReader);
+		} while (doWait && !done);
+		return done;
 	}
 };
 
@@ -0,0 +1,847 @@
+#ifndef BOMBA_IO_URING_SERVER_HPP
+#define BOMBA_IO_URING_SERVER_HPP
+
+#ifndef BOMBA_TCP_SERVER_HPP
+#include "bomba_tcp_server.hpp"
+#endif
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <system_error>
+#include <cerrno>
+
+namespace Bomba {
+
+namespace Detail {
+
+// liburing is not needed, the kernel interface is used directly
+class IoUring {
+	int _handle = -1;
+	void* _rings = nullptr;
+	size_t _ringsSize = 0;
+	io_uring_sqe* _submissions = nullptr;
+	size_t _submissionsSize = 0;
+
+	unsigned* _submissionHead = nullptr;
+	unsigned* _submissionTail = nullptr;
+	unsigned _submissionMask = 0;
+	unsigned _submissionEntries = 0;
+	unsigned _prepared = 0; // Local tail, published to the kernel only when submitting
+	unsigned _submitted = 0;
+
+	unsigned* _completionHead = nullptr;
+	unsigned* _completionTail = nullptr;
+	unsigned _completionMask = 0;
+	io_uring_cqe* _completions = nullptr;
+
+	template <typename T>
+	T* at(unsigned offset) {
+		return reinterpret_cast<T*>(reinterpret_cast<char*>(_rings) + offset);
+	}
+
+	static void check(long result, const char* what) {
+		if (result < 0) [[unlikely]]
+			throw std::system_error(errno, std::system_category(), what);
+	}
+
+public:
+	IoUring(unsigned entries) {
+		io_uring_params parameters = {};
+		// Many connections can complete at once, the completion queue is larger so that it doesn't overflow
+		parameters.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+		parameters.cq_entries = entries * 4;
+		_handle = syscall(__NR_io_uring_setup, entries, &parameters);
+		check(_handle, "io_uring_setup");
+		if (!(parameters.features & IORING_FEAT_SINGLE_MMAP)) [[unlikely]] {
+			::close(_handle);
+			throw std::system_error(std::make_error_code(std::errc::not_supported), "io_uring is too old");
+		}
+
+		_ringsSize = std::max(parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned),
+				parameters.cq_off.cqes + parameters.cq_entries * sizeof(io_uring_cqe));
+		_rings = mmap(nullptr, _ringsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _handle, IORING_OFF_SQ_RING);
+		if (_rings == MAP_FAILED) [[unlikely]] {
+			::close(_handle);
+			check(-1, "mmap of io_uring rings");
+		}
+		_submissionsSize = parameters.sq_entries * sizeof(io_uring_sqe);
+		void* submissions = mmap(nullptr, _submissionsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _handle, IORING_OFF_SQES);
+		if (submissions == MAP_FAILED) [[unlikely]] {
+			munmap(_rings, _ringsSize);
+			::close(_handle);
+			check(-1, "mmap of io_uring submissions");
+		}
+		_submissions = reinterpret_cast<io_uring_sqe*>(submissions);
+
+		_submissionHead = at<unsigned>(parameters.sq_off.head);
+		_submissionTail = at<unsigned>(parameters.sq_off.tail);
+		_submissionMask = *at<unsigned>(parameters.sq_off.ring_mask);
+		_submissionEntries = *at<unsigned>(parameters.sq_off.ring_entries);
+		_prepared = _submitted = *_submissionTail;
+		unsigned* indexes = at<unsigned>(parameters.sq_off.array);
+		for (unsigned i = 0; i < _submissionEntries; i++) {
+			indexes[i] = i; // Submission entries are always used in order
+		}
+
+		_completionHead = at<unsigned>(parameters.cq_off.head);
+		_completionTail = at<unsigned>(parameters.cq_off.tail);
+		_completionMask = *at<unsigned>(parameters.cq_off.ring_mask);
+		_completions = at<io_uring_cqe>(parameters.cq_off.cqes);
+	}
+
+	IoUring(const IoUring&) = delete;
+	IoUring& operator=(const IoUring&) = delete;
+
+	~IoUring() {
+		munmap(_submissions, _submissionsSize);
+		munmap(_rings, _ringsSize);
+		::close(_handle);
+	}
+
+	int handle() const {
+		return _handle;
+	}
+
+	// The entry is only passed to the kernel on the next call to submit()
+	io_uring_sqe& prepare() {
+		while (_prepared - std::atomic_ref(*_submissionHead).load(std::memory_order_acquire) >= _submissionEntries) [[unlikely]]
+			submit(false);
+		io_uring_sqe& entry = _submissions[_prepared & _submissionMask];
+		memset(&entry, 0, sizeof(entry));
+		_prepared++;
+		return entry;
+	}
+
+	// Submits all prepared operations in one system call, optionally waiting until at least one operation completes
+	void submit(bool wait) {
+		std::atomic_ref(*_submissionTail).store(_prepared, std::memory_order_release);
+		while (true) {
+			int submitted = syscall(__NR_io_uring_enter, _handle, _prepared - _submitted, wait ? 1 : 0, IORING_ENTER_GETEVENTS, nullptr, 0);
+			if (submitted >= 0) [[likely]] {
+				_submitted += submitted;
+				return;
+			}
+			if (errno == EINTR) {
+				if (wait)
+					return; // The caller checks whether to continue waiting
+			} else if (errno == EBUSY || errno == EAGAIN) {
+				return; // Completions must be processed before more can be submitted
+			} else {
+				check(-1, "io_uring_enter");
+			}
+		}
+	}
+
+	template <typename Handler>
+	void forEachCompletion(const Handler& handler) {
+		unsigned head = *_completionHead;
+		unsigned tail = std::atomic_ref(*_completionTail).load(std::memory_order_acquire);
+		while (head != tail) {
+			io_uring_cqe completion = _completions[head & _completionMask];
+			head++;
+			// The entry was copied, its slot can be reused even if the handler takes long
+			std::atomic_ref(*_completionHead).store(head, std::memory_order_release);
+			handler(completion);
+			if (head == tail)
+				tail = std::atomic_ref(*_completionTail).load(std::memory_order_acquire);
+		}
+	}
+};
+
+// Buffers the kernel picks from when a multishot receive gets data, so idle connections don't hold any receive buffer
+class IoUringBufferRing {
+	IoUring& _ring;
+	io_uring_buf* _entries = nullptr; // Not io_uring_buf_ring, its flexible array member is misplaced when compiled as C++
+	size_t _entriesSize = 0;
+	std::unique_ptr<char[]> _memory;
+	int _count = 0;
+	int _size = 0;
+	uint16_t _tail = 0;
+	uint16_t _group = 0;
+
+public:
+	IoUringBufferRing(IoUring& ring, int count, int size, uint16_t group) // Count must be a power of two
+			: _ring(ring), _memory(std::make_unique<char[]>(count * size)), _count(count), _size(size), _group(group) {
+		_entriesSize = count * sizeof(io_uring_buf);
+		void* entries = mmap(nullptr, _entriesSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+		if (entries == MAP_FAILED) [[unlikely]]
+			throw std::system_error(errno, std::system_category(), "mmap of io_uring buffer ring");
+		_entries = reinterpret_cast<io_uring_buf*>(entries);
+
+		io_uring_buf_reg registration = {};
+		registration.ring_addr = reinterpret_cast<uint64_t>(_entries);
+		registration.ring_entries = count;
+		registration.bgid = group;
+		if (syscall(__NR_io_uring_register, _ring.handle(), IORING_REGISTER_PBUF_RING, &registration, 1) < 0) [[unlikely]] {
+			int error = errno;
+			munmap(_entries, _entriesSize);
+			throw std::system_error(error, std::system_category(), "registering io_uring buffer ring");
+		}
+		for (int i = 0; i < count; i++) {
+			giveBack(i);
+		}
+	}
+
+	IoUringBufferRing(const IoUringBufferRing&) = delete;
+	IoUringBufferRing& operator=(const IoUringBufferRing&) = delete;
+
+	~IoUringBufferRing() {
+		io_uring_buf_reg registration = {};
+		registration.bgid = _group;
+		syscall(__NR_io_uring_register, _ring.handle(), IORING_UNREGISTER_PBUF_RING, &registration, 1);
+		munmap(_entries, _entriesSize);
+	}
+
+	uint16_t group() const {
+		return _group;
+	}
+
+	std::span<char> buffer(int index, int length) {
+		return std::span<char>(_memory.get() + index * _size, length);
+	}
+
+	void giveBack(int index) {
+		io_uring_buf& entry = _entries[_tail & (_count - 1)];
+		entry.addr = reinterpret_cast<uint64_t>(_memory.get() + index * _size);
+		entry.len = _size;
+		entry.bid = index;
+		_tail++;
+		// The ring's tail overlays the first entry's reserved field
+		std::atomic_ref(_entries[0].resv).store(_tail, std::memory_order_release);
+	}
+};
+
+} // namespace Detail
+
+// Same behaviour as TcpServer, but uses io_uring (Linux 6.0 or newer) instead of std::experimental::net.
+// Connections are accepted by one multishot accept and each session has one multishot receive that lets the kernel
+// pick a buffer from a shared ring. Responses produced while handling a batch of completions are submitted together
+// with the wait for the next batch, in one system call. It's single-threaded, ShardedIoUringTcpServer scales it.
+template <typename Responder>
+class IoUringTcpServer {
+	constexpr static int RingEntries = 1024;
+	constexpr static int ReceiveBufferCount = 256;
+	constexpr static int ReceiveBufferSize = 4096;
+
+	enum class Operation : uint64_t {
+		// Stored in the lowest bits of the operation's user data, the rest is the session's address
+		ACCEPT,
+		RECEIVE,
+		SEND,
+		WAKE,
+		CANCEL,
+		TICK,
+	};
+	constexpr static uint64_t OperationMask = 0x7;
+
+	Responder& _responder;
+	std::string _unixSocketPath; // Empty if listening on a TCP port
+	int _listener = -1;
+	int _waker = -1;
+	uint64_t _wakerValue = 0;
+	Detail::IoUring _ring = Detail::IoUring(RingEntries);
+	Detail::IoUringBufferRing _receiveBuffers = Detail::IoUringBufferRing(_ring, ReceiveBufferCount, ReceiveBufferSize, 0);
+	ReceiveBufferPool _leftoverBuffers; // For incomplete messages, which can't stay in the ring
+	std::atomic<bool> _stopped = false;
+	LatencyHistogram _latency;
+	TcpServerCounters _counters;
+	LatencyHistogram _offloadedLatency; // Recorded by the executor's threads
+	LatencySnapshot _latencyBaseline; // Subtracted from the recorded latencies, for resetting them
+	std::mutex _latencyLock;
+	std::atomic<int64_t> _bytesQueued = 0;
+	int64_t _outputHighWatermark = 65536;
+	int64_t _outputLowWatermark = 16384;
+	int _maxMessageSize = TcpServerBuffer::DefaultMaxMessageSize;
+	TcpServerTimeouts _timeouts;
+	Detail::TimerWheel _timers;
+	__kernel_timespec _nextTick = {};
+	bool _ticking = false; // A timeout operation is pending, only while some timer is armed
+	ThreadPool* _executor = nullptr;
+	std::atomic<int> _offloadedTasks = 0;
+
+	struct alignas(OperationMask + 1) Session : ITcpServerSession, Detail::SessionDeadline, IPoolTask {
+		int _socket = -1; // Negative while the session is not in use
+		std::optional<typename Responder::Session> _responder;
+		TcpServerBuffer _buffer;
+		IoUringTcpServer* _parent = nullptr;
+		ThreadPool* _executor = nullptr;
+
+		std::vector<char> _outputQueue;
+		std::vector<char> _outputSending;
+		int _sendingPosition = 0;
+		int _earlySent = 0; // The start of the output queue that was sent while the responder was writing
+		bool _receiving = false; // The multishot receive is armed
+		bool _sending = false;
+		bool _socketFull = false; // Sending early is pointless until a send completes
+		bool _readingPaused = false;
+		bool _closing = false;
+
+		// While the executor processes the requests, the multishot receive keeps running, but the received data
+		// are put aside and processed after it finishes, so the responses stay in order
+		bool _offloaded = false;
+		bool _inputEnded = false; // The client stopped sending while the executor was processing its requests
+		int64_t _offloadedProcessed = 0;
+		std::vector<char> _offloadedOutput;
+		std::vector<char> _arrivedMeanwhile;
+		Session* _nextFinished = nullptr;
+		std::chrono::steady_clock::time_point _messageStart; // When processing of the current message started
+
+		void open(int socket, IoUringTcpServer& parent) {
+			_socket = socket;
+			_parent = &parent;
+			_executor = parent._executor;
+			_responder.emplace(parent._responder.getSession());
+			_buffer.reset(&parent._leftoverBuffers, parent._maxMessageSize, &parent._counters);
+			parent._counters.accepted.add(1);
+			int enabled = 1;
+			setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+			updateDeadline();
+			receive();
+		}
+
+		void recycle() {
+			_parent->_bytesQueued.fetch_sub(queuedBytes() + _offloadedOutput.size(), std::memory_order_relaxed);
+			_parent->_counters.closed.add(1);
+			stop(_parent->_timers);
+			::close(_socket);
+			_socket = -1;
+			_responder.reset();
+			_buffer.reset(nullptr);
+			for (std::vector<char>* output : {&_outputQueue, &_outputSending, &_offloadedOutput, &_arrivedMeanwhile}) {
+				output->clear();
+				if (int64_t(output->capacity()) > _parent->_outputHighWatermark) [[unlikely]]
+					*output = {};
+			}
+			_sendingPosition = 0;
+			_earlySent = 0;
+			_receiving = false;
+			_sending = false;
+			_socketFull = false;
+			_readingPaused = false;
+			_closing = false;
+			_inputEnded = false;
+		}
+
+		uint64_t userData(Operation operation) {
+			return reinterpret_cast<uint64_t>(this) | uint64_t(operation);
+		}
+
+		void receive() {
+			io_uring_sqe& entry = _parent->_ring.prepare();
+			entry.opcode = IORING_OP_RECV;
+			entry.fd = _socket;
+			entry.ioprio = IORING_RECV_MULTISHOT;
+			entry.flags = IOSQE_BUFFER_SELECT;
+			entry.buf_group = _parent->_receiveBuffers.group();
+			entry.user_data = userData(Operation::RECEIVE);
+			_receiving = true;
+		}
+
+		void received(const io_uring_cqe& completion) {
+			bool finished = !(completion.flags & IORING_CQE_F_MORE);
+			if (finished)
+				_receiving = false;
+			if (completion.res > 0) [[likely]]
+				_parent->_counters.bytesReceived.add(completion.res);
+			if (_closing) {
+				if (completion.flags & IORING_CQE_F_BUFFER)
+					_parent->_receiveBuffers.giveBack(completion.flags >> IORING_CQE_BUFFER_SHIFT);
+				finishClosing();
+				return;
+			}
+			if (completion.res == -ENOBUFS || completion.res == -ECANCELED) [[unlikely]] {
+				// Ran out of buffers (they were given back in the meantime) or stopped because too much output is queued
+				if (!_readingPaused)
+					receive();
+				return;
+			}
+			if (_executor) [[unlikely]] {
+				receivedForExecutor(completion, finished);
+				return;
+			}
+			bool expectingMore = false;
+			if (completion.res > 0) [[likely]] {
+				_messageStart = std::chrono::steady_clock::now();
+				int bufferIndex = completion.flags >> IORING_CQE_BUFFER_SHIFT;
+				expectingMore = _buffer.receive(*this, _parent->_receiveBuffers.buffer(bufferIndex, completion.res));
+				_parent->_receiveBuffers.giveBack(bufferIndex);
+			}
+			flush();
+
+			if (expectingMore) {
+				updateDeadline();
+				if (queuedBytes() >= _parent->_outputHighWatermark) [[unlikely]]
+					pauseReading();
+				else if (finished)
+					receive();
+			}
+
+			if (!expectingMore) {
+				// Responses to the last requests are still sent if the connection wasn't broken
+				if (completion.res < 0 || !_sending)
+					cancel();
+				else
+					_closing = true;
+			}
+		}
+
+		void pauseReading() {
+			_readingPaused = true;
+			if (_receiving) {
+				io_uring_sqe& entry = _parent->_ring.prepare();
+				entry.opcode = IORING_OP_ASYNC_CANCEL;
+				entry.addr = userData(Operation::RECEIVE);
+				entry.user_data = uint64_t(Operation::CANCEL);
+			}
+		}
+
+		void receivedForExecutor(const io_uring_cqe& completion, bool finished) {
+			if (completion.res <= 0) {
+				if (completion.res == 0 && _offloaded) {
+					_inputEnded = true; // The responses to the requests being processed are still sent
+					return;
+				}
+				if (completion.res < 0 || !_sending)
+					cancel();
+				else
+					_closing = true;
+				return;
+			}
+			int bufferIndex = completion.flags >> IORING_CQE_BUFFER_SHIFT;
+			std::span<char> data = _parent->_receiveBuffers.buffer(bufferIndex, completion.res);
+			if (_offloaded) {
+				_arrivedMeanwhile.insert(_arrivedMeanwhile.end(), data.begin(), data.end());
+				if (std::ssize(_arrivedMeanwhile) >= _parent->_outputHighWatermark) [[unlikely]]
+					pauseReading();
+			} else {
+				int64_t stored = _buffer.store(data);
+				_arrivedMeanwhile.insert(_arrivedMeanwhile.end(), data.begin() + stored, data.end());
+				offload();
+			}
+			_parent->_receiveBuffers.giveBack(bufferIndex);
+			if (finished && !_readingPaused)
+				receive();
+		}
+
+		void offload() {
+			_offloaded = true;
+			busy(_parent->_timers);
+			_parent->_offloadedTasks.fetch_add(1, std::memory_order_relaxed);
+			_executor->submit(*this);
+		}
+
+		// Runs on a thread of the executor, the server's thread doesn't touch the buffer or the responder meanwhile
+		void run() override {
+			_messageStart = std::chrono::steady_clock::now();
+			_offloadedProcessed = TcpServerBuffer::processMessages(*this, _buffer.unprocessed());
+			IoUringTcpServer* parent = _parent; // Once it's pushed, the session may be closed and reused
+			if (parent->_finished.push(this)) {
+				uint64_t increment = 1;
+				[[maybe_unused]] auto written = ::write(parent->_waker, &increment, sizeof(increment));
+			}
+			parent->_offloadedTasks.fetch_sub(1, std::memory_order_release);
+		}
+
+		// Back on the server's thread
+		void finishOffloaded() {
+			_offloaded = false;
+			if (_closing) {
+				finishClosing();
+				return;
+			}
+			if (_outputQueue.empty())
+				std::swap(_outputQueue, _offloadedOutput);
+			else
+				_outputQueue.insert(_outputQueue.end(), _offloadedOutput.begin(), _offloadedOutput.end());
+			_offloadedOutput.clear();
+			bool expectingMore = _buffer.consumeProcessed(_offloadedProcessed);
+			flush();
+
+			if (expectingMore && !_arrivedMeanwhile.empty()) {
+				int64_t stored = _buffer.store(_arrivedMeanwhile);
+				_arrivedMeanwhile.erase(_arrivedMeanwhile.begin(), _arrivedMeanwhile.begin() + stored);
+				offload();
+				return;
+			}
+			if (expectingMore && !_inputEnded) {
+				updateDeadline();
+				if (queuedBytes() >= _parent->_outputHighWatermark) [[unlikely]]
+					pauseReading();
+				else if (_readingPaused) {
+					_readingPaused = false;
+					if (!_receiving)
+						receive();
+				}
+				return;
+			}
+			if (!_sending)
+				cancel();
+			else
+				_closing = true;
+		}
+
+		int64_t queuedBytes() const {
+			return _outputQueue.size() - _earlySent + _outputSending.size() - _sendingPosition;
+		}
+
+		void flush() {
+			if (_sending || _outputQueue.empty())
+				return;
+			if (_earlySent == std::ssize(_outputQueue)) {
+				_outputQueue.clear();
+				_earlySent = 0;
+				return;
+			}
+			std::swap(_outputQueue, _outputSending);
+			_outputQueue.clear();
+			_sendingPosition = _earlySent;
+			_earlySent = 0;
+			sendSome();
+		}
+
+		// Sends output while the responder is still writing, the completion of an asynchronous send couldn't be processed
+		// before it finishes, so the queue is sent directly as long as the socket takes it and the rest waits for flush()
+		void sendEarly() {
+			if (_sending || _socketFull)
+				return;
+			int64_t unsent = std::ssize(_outputQueue) - _earlySent;
+			int64_t sent = ::send(_socket, _outputQueue.data() + _earlySent, unsent, MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (sent < unsent)
+				_socketFull = true; // Errors are found by the asynchronous send
+			if (sent <= 0)
+				return;
+			_parent->_bytesQueued.fetch_sub(sent, std::memory_order_relaxed);
+			_parent->_counters.bytesSent.add(sent);
+			_earlySent += sent;
+		}
+
+		void sendSome() {
+			io_uring_sqe& entry = _parent->_ring.prepare();
+			entry.opcode = IORING_OP_SEND;
+			entry.fd = _socket;
+			entry.addr = reinterpret_cast<uint64_t>(_outputSending.data() + _sendingPosition);
+			entry.len = _outputSending.size() - _sendingPosition;
+			entry.msg_flags = MSG_NOSIGNAL;
+			entry.user_data = userData(Operation::SEND);
+			_sending = true;
+		}
+
+		void sent(const io_uring_cqe& completion) {
+			_sending = false;
+			_socketFull = false;
+			if (completion.res < 0) {
+				_parent->_bytesQueued.fetch_sub(queuedBytes(), std::memory_order_relaxed);
+				_outputQueue.clear();
+				_outputSending.clear();
+				_sendingPosition = 0;
+				_earlySent = 0;
+				cancel();
+				return;
+			}
+			_parent->_bytesQueued.fetch_sub(completion.res, std::memory_order_relaxed);
+			_parent->_counters.bytesSent.add(completion.res);
+			_sendingPosition += completion.res;
+			if (_sendingPosition < std::ssize(_outputSending)) {
+				sendSome();
+				return;
+			}
+			_outputSending.clear();
+			_sendingPosition = 0;
+			flush();
+			if (_closing && !_sending) {
+				cancel();
+				return;
+			}
+			if (_offloaded) [[unlikely]]
+				return; // Continues when the executor finishes
+			updateDeadline();
+			if (_readingPaused && queuedBytes() <= _parent->_outputLowWatermark) {
+				_readingPaused = false;
+				if (!_receiving)
+					receive();
+			}
+		}
+
+		void updateDeadline() {
+			update(_parent->_timers, _parent->_timeouts, _buffer, *_responder);
+			_parent->keepTicking();
+		}
+
+		void expired() override {
+			_parent->_counters.timedOut.add(1);
+			cancel();
+		}
+
+		void cancel() { // MUST RETURN AFTER CALLING cancel(), IT MAY DESTROY this
+			_closing = true;
+			::shutdown(_socket, SHUT_RDWR); // Ends the multishot receive
+			finishClosing();
+		}
+
+		void finishClosing() {
+			if (!_receiving && !_sending && !_offloaded)
+				_parent->destroySession(this);
+		}
+
+		std::pair<ServerReaction, int> feedToResponder(std::span<char> data) override {
+			return _responder->respond(data, [this] (std::span<const char> output) {
+				std::vector<char>& target = _offloaded ? _offloadedOutput : _outputQueue;
+				target.insert(target.end(), output.begin(), output.end());
+				_parent->_bytesQueued.fetch_add(output.size(), std::memory_order_relaxed);
+				if (!_offloaded && std::ssize(_outputQueue) - _earlySent >= Detail::EarlySendSize) [[unlikely]]
+					sendEarly();
+			});
+		}
+
+		// A single clock reading ends one message's time and starts the next one's
+		void notifyMessageWasParsed() override {
+			auto now = std::chrono::steady_clock::now();
+			if (_offloaded) [[unlikely]]
+				_parent->_offloadedLatency.recordConcurrently(now - _messageStart);
+			else
+				_parent->_latency.record(now - _messageStart);
+			_messageStart = now;
+		}
+
+		~Session() {
+			if (_socket >= 0)
+				::close(_socket);
+		}
+	};
+
+	Detail::SessionSlab<Session> _sessions;
+	Detail::MpscQueue<Session, &Session::_nextFinished> _finished; // Sessions whose requests the executor processed
+
+	void accept() {
+		io_uring_sqe& entry = _ring.prepare();
+		entry.opcode = IORING_OP_ACCEPT;
+		entry.fd = _listener;
+		entry.ioprio = IORING_ACCEPT_MULTISHOT;
+		entry.user_data = uint64_t(Operation::ACCEPT);
+	}
+
+	void waitForWaking() {
+		io_uring_sqe& entry = _ring.prepare();
+		entry.opcode = IORING_OP_READ;
+		entry.fd = _waker;
+		entry.addr = reinterpret_cast<uint64_t>(&_wakerValue);
+		entry.len = sizeof(_wakerValue);
+		entry.user_data = uint64_t(Operation::WAKE);
+	}
+
+	void destroySession(Session* session) {
+		session->recycle();
+		_sessions.release(session);
+	}
+
+	// Timers are checked by a timeout operation that is pending only while some timer is armed
+	void keepTicking() {
+		if (_ticking || _timers.empty())
+			return;
+		_ticking = true;
+		auto nextTick = _timers.nextTick().time_since_epoch(); // Absolute timeouts use the same clock as steady_clock
+		_nextTick.tv_sec = std::chrono::duration_cast<std::chrono::seconds>(nextTick).count();
+		_nextTick.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(nextTick % std::chrono::seconds(1)).count();
+		io_uring_sqe& entry = _ring.prepare();
+		entry.opcode = IORING_OP_TIMEOUT;
+		entry.addr = reinterpret_cast<uint64_t>(&_nextTick);
+		entry.len = 1;
+		entry.timeout_flags = IORING_TIMEOUT_ABS;
+		entry.user_data = uint64_t(Operation::TICK);
+	}
+
+	void processCompletions() {
+		_ring.forEachCompletion([this] (const io_uring_cqe& completion) {
+			Operation operation = Operation(completion.user_data & OperationMask);
+			Session* session = reinterpret_cast<Session*>(completion.user_data & ~OperationMask);
+			switch (operation) {
+			case Operation::ACCEPT:
+				if (completion.res >= 0) [[likely]] {
+					BOMBA_TRACE_SCOPE("accept");
+					Session* session = _sessions.acquire();
+					if (session) [[likely]] {
+						session->open(completion.res, *this);
+					} else {
+						::close(completion.res); // Too many connections
+						_counters.refused.add(1);
+					}
+				}
+				if (!(completion.flags & IORING_CQE_F_MORE) && !_stopped.load(std::memory_order_relaxed))
+					accept();
+				break;
+			case Operation::RECEIVE:
+				session->received(completion);
+				break;
+			case Operation::SEND:
+				session->sent(completion);
+				break;
+			case Operation::WAKE:
+				waitForWaking();
+				_finished.consume([] (Session* session) {
+					session->finishOffloaded();
+				});
+				break;
+			case Operation::CANCEL:
+				break;
+			case Operation::TICK:
+				_ticking = false;
+				_timers.advance(std::chrono::steady_clock::now());
+				keepTicking();
+				break;
+			}
+		});
+	}
+
+	static int makeListener(int port, bool reusePort) {
+		int listener = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (listener < 0) [[unlikely]]
+			throw std::system_error(errno, std::system_category(), "socket");
+		int enabled = 1;
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enabled, sizeof(enabled));
+		if (reusePort)
+			setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &enabled, sizeof(enabled));
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+		address.sin_addr.s_addr = htonl(INADDR_ANY);
+		if (::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+				|| ::listen(listener, SOMAXCONN) < 0) [[unlikely]] {
+			int error = errno;
+			::close(listener);
+			throw std::system_error(error, std::system_category(), "binding the listening socket");
+		}
+		return listener;
+	}
+
+	template <typename, template <typename> typename>
+	friend class ShardedTcpServer;
+
+public:
+	constexpr static int DefaultMaxConnections = 1024;
+
+	IoUringTcpServer(Responder& responder, int port, int maxConnections = DefaultMaxConnections)
+			: _responder(responder), _listener(makeListener(port, false)), _waker(eventfd(0, EFD_CLOEXEC)), _sessions(maxConnections) {
+		accept();
+		waitForWaking();
+	}
+	// Binds its own listening socket with SO_REUSEPORT, other servers can listen on the same port
+	IoUringTcpServer(Responder& responder, int port, ReusePort, int maxConnections = DefaultMaxConnections)
+			: _responder(responder), _listener(makeListener(port, true)), _waker(eventfd(0, EFD_CLOEXEC)), _sessions(maxConnections) {
+		accept();
+		waitForWaking();
+	}
+
+	// Listens on a Unix domain socket, its file is removed when the server is destroyed
+	IoUringTcpServer(Responder& responder, UnixSocketPath path, int maxConnections = DefaultMaxConnections)
+			: _responder(responder), _unixSocketPath(path.path), _listener(Detail::listenOnUnixSocket(_unixSocketPath)),
+			_waker(eventfd(0, EFD_CLOEXEC)), _sessions(maxConnections) {
+		accept();
+		waitForWaking();
+	}
+
+	IoUringTcpServer(const IoUringTcpServer&) = delete;
+	IoUringTcpServer& operator=(const IoUringTcpServer&) = delete;
+
+	~IoUringTcpServer() {
+		// The executor may still be processing requests of some sessions
+		while (_offloadedTasks.load(std::memory_order_acquire) > 0)
+			std::this_thread::yield();
+		for (int i = 0; i < _sessions.capacity(); i++) {
+			if (_sessions[i]._socket >= 0)
+				::shutdown(_sessions[i]._socket, SHUT_RDWR);
+		}
+		// The ring keeps its own reference to the listening socket until it's torn down, this frees the port immediately
+		::shutdown(_listener, SHUT_RDWR);
+		::close(_listener);
+		::close(_waker);
+		if (!_unixSocketPath.empty())
+			::unlink(_unixSocketPath.c_str());
+	}
+
+	void run() {
+		while (!_stopped.load(std::memory_order_relaxed)) {
+			_ring.submit(true);
+			processCompletions();
+		}
+	}
+
+	// Can be called from any thread
+	void stopRunning() {
+		_stopped = true;
+		uint64_t value = 1;
+		[[maybe_unused]] auto written = ::write(_waker, &value, sizeof(value));
+	}
+
+	void runARound() {
+		_ring.submit(false);
+		processCompletions();
+	}
+
+	int threadCount() const {
+		return 1;
+	}
+
+	int connectionCount() const {
+		return _sessions.used();
+	}
+
+	void setOutputWatermarks(int64_t high, int64_t low) {
+		_outputHighWatermark = high;
+		_outputLowWatermark = low;
+	}
+
+	void setMaxMessageSize(int size) {
+		_maxMessageSize = size;
+	}
+
+	void setTimeouts(const TcpServerTimeouts& timeouts) {
+		_timeouts = timeouts;
+	}
+
+	void setExecutor(ThreadPool* executor) {
+		_executor = executor;
+	}
+
+	int64_t bytesQueued() const {
+		return _bytesQueued.load(std::memory_order_relaxed);
+	}
+
+	// Times of processing of messages received since the start or since resetLatency()
+	LatencySnapshot latency() {
+		LatencySnapshot snapshot;
+		_latency.addTo(snapshot);
+		_offloadedLatency.addTo(snapshot);
+		std::lock_guard lock(_latencyLock);
+		snapshot -= _latencyBaseline;
+		return snapshot;
+	}
+
+	void resetLatency() {
+		LatencySnapshot snapshot = latency();
+		std::lock_guard lock(_latencyLock);
+		_latencyBaseline += snapshot;
+	}
+
+	TcpServerMetrics metrics() {
+		TcpServerMetrics metrics;
+		metrics.sessions = connectionCount();
+		metrics += _counters;
+		metrics.latency = latency();
+		return metrics;
+	}
+
+	std::chrono::nanoseconds averageResponseTime() {
+		return latency().mean();
+	}
+};
+
+template <typename Responder>
+using ShardedIoUringTcpServer = ShardedTcpServer<Responder, IoUringTcpServer>;
+
+} // namespace Bomba
+
+#endif // BOMBA_IO_URING_SERVER_HPP
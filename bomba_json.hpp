@@ -131,6 +131,17 @@ struct BasicJson {
 				fail("Expected JSON string");
 			}
 			
+			// Strings without escape sequences can be returned directly without copying
+			for (int i = _position; _contents.begin() + i < _contents.end(); i++) {
+				if (_contents[i] == '"') [[unlikely]] {
+					std::string_view unescaped = _contents.substr(_position, i - _position);
+					_position = i + 1;
+					return unescaped;
+				}
+				if (_contents[i] == '\\') [[unlikely]]
+					break;
+			}
+
 			_resultBuffer.clear();
 			readingChar = getChar();
 			while (readingChar != '"') {
@@ -31,6 +31,7 @@ enum class JsonRpcError {
 template <BetterAssembledString LocalStringType = std::string>
 class JsonRpcServerProtocol : public IHttpPostResponder {
 	IRemoteCallable& _callable;
+	IRpcCallObserver* _observer = nullptr;
 	using Json = BasicJson<LocalStringType, GeneralisedBuffer>;
 
 	bool respondInternal(IStructuredInput& input, IStructuredOutput& output, Callback<> onResponseStarted) {
@@ -38,7 +39,6 @@ class JsonRpcServerProtocol : public IHttpPostResponder {
 		bool failed = false;
 		bool responding = false;
 		IStructuredInput::Location paramsPosition;
-		bool idWritten = false;
 
 		auto writeId = [&] {
 			responding = true;
@@ -65,6 +65,7 @@ class JsonRpcServerProtocol : public IHttpPostResponder {
 		};
 		auto introduceError = [&] (std::string_view message, JsonRpcError errorType = JsonRpcError::INTERNAL_ERROR) {
 			failed = true;
+			RpcCallTimer::failed();
 			if (!responding)
 				return;
 
@@ -88,12 +89,16 @@ class JsonRpcServerProtocol : public IHttpPostResponder {
 					if (paramsPosition) {
 						input.restorePosition(noFlags, paramsPosition);
 					}
+					RpcCallTimer timer(_observer, method);
+					bool done = false;
 					if (responding)
-						method->call(paramsPosition ? &input : nullptr, output, introduceResult, introduceError);
+						done = method->call(paramsPosition ? &input : nullptr, output, introduceResult, introduceError);
 					else {
 						NullStructredOutput nullOutput;
-						method->call(paramsPosition ? &input : nullptr, nullOutput, introduceResult, introduceError);
+						done = method->call(paramsPosition ? &input : nullptr, nullOutput, introduceResult, introduceError);
 					}
+					if (!done) [[unlikely]]
+						timer.fail();
 				}
 				return formerPosition;
 			};
@@ -167,6 +172,11 @@ public:
 	JsonRpcServerProtocol(IRemoteCallable& callable) : _callable(callable) {
 	}
 
+	// The observer is notified about every call, none is set by default
+	void setCallObserver(IRpcCallObserver* observer) {
+		_observer = observer;
+	}
+
 	bool post(std::string_view, std::string_view contentType, std::span<char> request, IWriteStarter& writeStarter) override {
 		if (contentType != "application/json") [[unlikely]] {
 			return false;
@@ -222,6 +232,14 @@ public:
 	Session getSession() {
 		return _http.getSession();
 	}
+
+	void setCallObserver(IRpcCallObserver* observer) {
+		_protocol.setCallObserver(observer);
+	}
+
+	void setMaxHeaderSize(int maxHeaderSize) {
+		_http.setMaxHeaderSize(maxHeaderSize);
+	}
 };
 
 template <typename HttpType, BetterAssembledString LocalStringType = std::string>
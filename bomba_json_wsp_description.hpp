@@ -8,6 +8,8 @@
 #include "bomba_json.hpp"
 #endif
 
+#include <algorithm>
+
 // Most information gathered from: https://zims-en.kiwix.campusafrica.gos.orange.com/wikipedia_en_all_nopic/A/JSON-WSP
 
 namespace Bomba {
@@ -147,13 +149,26 @@ public:
 	}
 };
 
+// Not a part of JSON-WSP, but harmless to clients that don't know it, the durations are averages per call
+inline void writeJsonWspStatistics(IStructuredOutput::ObjectFiller& output, const RpcMethodStatistics& statistics) {
+	auto made = output.writeObject("statistics", 5);
+	made.writeInt("calls", statistics.calls);
+	made.writeInt("errors", statistics.errors);
+	int64_t calls = std::max<int64_t>(statistics.calls, 1);
+	made.writeInt("parsing_ns", statistics.parsing.count() / calls);
+	made.writeInt("execution_ns", statistics.execution.count() / calls);
+	made.writeInt("serialisation_ns", statistics.serialisation.count() / calls);
+}
+
 template <BetterAssembledString StringType>
 class JsonWspDescription : public IRemoteCallableDescriptionFiller {
 	IStructuredOutput::ObjectFiller& _output;
 	StringType _path;
+	std::span<const RpcMethodStatistics> _statistics;
 	static constexpr SerialisationFlags::Flags noFlags = SerialisationFlags::NONE;
 public:
-	JsonWspDescription(IStructuredOutput::ObjectFiller& output, std::string_view name = "", std::string_view prefix = "") : _output(output) {
+	JsonWspDescription(IStructuredOutput::ObjectFiller& output, std::string_view name = "", std::string_view prefix = "",
+			std::span<const RpcMethodStatistics> statistics = {}) : _output(output), _statistics(statistics) {
 		if (!prefix.empty()) {
 			_path += prefix;
 			_path += '.';
@@ -169,8 +184,13 @@ public:
 		StringType methodName;
 		methodName += _path;
 		methodName += name;
-		auto methodObject = _output.writeObject(methodName, 3);
+		auto statistics = std::find_if(_statistics.begin(), _statistics.end(), [&] (const RpcMethodStatistics& method) {
+			return method.path == std::string_view(methodName);
+		});
+		auto methodObject = _output.writeObject(methodName, statistics == _statistics.end() ? 3 : 4);
 		writeJsonWspDocumentation(methodObject, description);
+		if (statistics != _statistics.end())
+			writeJsonWspStatistics(methodObject, *statistics);
 		{
 			auto paramsObject = methodObject.writeObject("params");
 			int methodDescriptorArgCount = 0;
@@ -181,13 +201,15 @@ public:
 		returnFiller(returnDescriptor);
 	}
 	void addSubobject(std::string_view name, Callback<void(IRemoteCallableDescriptionFiller&)> nestedFiller) override {
-		JsonWspDescription<StringType> subobjectFiller(_output, name, _path);
+		JsonWspDescription<StringType> subobjectFiller(_output, name, _path, _statistics);
 		nestedFiller(subobjectFiller);
 	}
 };
 
+// Statistics of methods (usually from RpcStatistics::snapshot()) are added to the descriptions of the methods
 template <BetterAssembledString StringType = std::string, BetterAssembledString AuxiliaryStrings = StringType>
-StringType describeInJsonWsp(IRemoteCallable& callable, std::string_view url, std::string_view name) {
+StringType describeInJsonWsp(IRemoteCallable& callable, std::string_view url, std::string_view name,
+		std::span<const RpcMethodStatistics> statistics = {}) {
 	StringType rawOutput;
 	typename BasicJson<AuxiliaryStrings, StringType>::Output outputInstance(rawOutput);
 	IStructuredOutput& output = outputInstance;
@@ -204,7 +226,7 @@ StringType describeInJsonWsp(IRemoteCallable& callable, std::string_view url, st
 		}
 		{
 			auto typesObject = mainObject.writeObject("methods");
-			JsonWspDescription<StringType> rpcDescriptor(typesObject);
+			JsonWspDescription<StringType> rpcDescriptor(typesObject, "", "", statistics);
 			callable.generateDescription(rpcDescriptor);
 		}
 	}
@@ -0,0 +1,308 @@
+//usr/bin/g++ --std=c++20 -Wall $0 -O2 -lpthread -o ${o=`mktemp`} && exec $o $*
+// Generates load on a HTTP or JSON-RPC server using Bomba's own client, prints the results as JSON.
+// Each thread keeps many connections busy, each with up to a given number of pipelined requests. Without a rate, every
+// connection sends a new request as soon as one is answered (closed loop). With a rate, requests are sent on a fixed
+// schedule regardless of how fast the server answers (open loop). In that case, latency is measured from the time a request
+// was scheduled for, not from when it was actually sent, so that a stalling server can't hide its stalls by delaying
+// the requests that would reveal them (coordinated omission).
+//
+// Options (all optional):
+// --host 127.0.0.1 --port 8080
+// --protocol http|jsonrpc
+// --path / (the resource downloaded through HTTP)
+// --requests file (JSON-RPC calls to replay in a loop, one per line as {"method" : "name", "params" : {...}})
+// --threads 1 --connections 16 (per thread) --depth 1 (pipelined requests per connection)
+// --rate 0 (requests per second in total, 0 means closed loop) --duration 10 (seconds)
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <charconv>
+#include <algorithm>
+#include "bomba_core.hpp"
+#include "bomba_json.hpp"
+#include "bomba_http.hpp"
+#include "bomba_sync_client.hpp"
+#include "bomba_tcp_server.hpp"
+
+using namespace Bomba;
+
+struct Options {
+	std::string host = "127.0.0.1";
+	std::string port = "8080";
+	std::string protocol = "http";
+	std::string path = "/";
+	std::string requests;
+	int threads = 1;
+	int connections = 16;
+	int depth = 1;
+	double rate = 0;
+	double duration = 10;
+};
+
+// A JSON-RPC call prepared to be sent after the id, which comes first so that the server can report errors
+struct RecordedCall {
+	std::string ending;
+};
+
+std::vector<RecordedCall> readCalls(const std::string& fileName) {
+	std::ifstream file(fileName);
+	if (!file.good())
+		throw std::runtime_error("Can't open " + fileName);
+	std::vector<RecordedCall> calls;
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.empty() || line[0] == '#')
+			continue;
+		BasicJson<>::Input input(line);
+		std::string method;
+		std::string_view params;
+		input.readObject(SerialisationFlags::NONE, [&] (std::optional<std::string_view> name, int) {
+			if (*name == "method") {
+				method = input.readString(SerialisationFlags::NONE);
+			} else if (*name == "params") {
+				int start = input.storePosition(SerialisationFlags::NONE).loc;
+				input.skipObjectElement(SerialisationFlags::NONE);
+				params = std::string_view(line).substr(start, input.storePosition(SerialisationFlags::NONE).loc - start);
+			} else {
+				input.skipObjectElement(SerialisationFlags::NONE);
+			}
+			return true;
+		});
+		if (!input.good || method.empty())
+			throw std::runtime_error("Can't read the JSON-RPC call " + line);
+
+		std::string ending = ",\"method\":\"" + method + '"';
+		if (!params.empty()) {
+			ending += ",\"params\":";
+			ending += params;
+		}
+		ending += '}';
+		calls.push_back({ending});
+	}
+	if (calls.empty())
+		throw std::runtime_error("No JSON-RPC calls in " + fileName);
+	return calls;
+}
+
+struct ThreadResults {
+	LatencyHistogram latency;
+	int64_t errors = 0;
+};
+
+class Connection {
+	struct Pending {
+		RequestToken token;
+		std::chrono::steady_clock::time_point intended;
+	};
+	const Options& _options;
+	const std::vector<RecordedCall>& _calls;
+	SyncNetworkClient _client;
+	HttpClient<> _http;
+	std::vector<Pending> _pending;
+	int _oldest = 0;
+	int _pendingCount = 0;
+	int _nextCall = 0;
+	std::chrono::steady_clock::time_point _nextScheduled;
+	std::chrono::nanoseconds _interval;
+
+	void send(std::chrono::steady_clock::time_point intended) {
+		Pending& sent = _pending[(_oldest + _pendingCount) % _pending.size()];
+		sent.intended = intended;
+		if (_calls.empty()) {
+			sent.token = _http.get(_options.path);
+		} else {
+			const RecordedCall& call = _calls[_nextCall];
+			_nextCall = (_nextCall + 1) % _calls.size();
+			sent.token = _http.post("application/json", [&] (GeneralisedBuffer& output, RequestToken token) {
+				output += "{\"jsonrpc\":\"2.0\",\"id\":";
+				std::array<char, 12> id = {};
+				auto written = std::to_chars(id.data(), id.data() + id.size(), token.id);
+				output += std::string_view(id.data(), written.ptr);
+				output += std::string_view(call.ending);
+			});
+		}
+		_pendingCount++;
+	}
+
+	// Returns false if the response has not arrived completely yet, it's read again on the next call
+	bool receive(ThreadResults& results) {
+		Pending& received = _pending[_oldest];
+		if (!_http.tryToGetResponse(received.token, [&] (std::span<char> body, bool success) {
+			if (!success || (!_calls.empty() && std::string_view(body.data(), body.size()).find("\"error\"") != std::string_view::npos))
+				results.errors++;
+			return true;
+		}))
+			return false;
+		results.latency.record(std::chrono::steady_clock::now() - received.intended);
+		_oldest = (_oldest + 1) % _pending.size();
+		_pendingCount--;
+		return true;
+	}
+
+public:
+	// The first request is scheduled at the start plus the given fraction of the interval, to spread the connections
+	Connection(const Options& options, const std::vector<RecordedCall>& calls, std::chrono::steady_clock::time_point start,
+			double offset, int firstCall)
+			: _options(options), _calls(calls), _client(options.host, options.port), _http(_client, options.host),
+			_pending(options.depth), _nextCall(calls.empty() ? 0 : firstCall % calls.size()) {
+		if (options.rate > 0) {
+			_interval = std::chrono::nanoseconds(int64_t(1e9 * options.threads * options.connections / options.rate));
+			_nextScheduled = start + std::chrono::nanoseconds(int64_t(_interval.count() * offset));
+		}
+	}
+
+	// Sends and receives what it can without waiting for the server, returns if it did anything
+	bool progress(std::chrono::steady_clock::time_point now, bool sending, ThreadResults& results) {
+		bool progressed = false;
+		while (sending && _pendingCount < std::ssize(_pending)) {
+			if (_options.rate > 0) {
+				if (_nextScheduled > now)
+					break;
+				send(_nextScheduled);
+				_nextScheduled += _interval;
+			} else {
+				send(now);
+			}
+			progressed = true;
+		}
+		while (_pendingCount > 0 && _client.hasReceivedData() && receive(results))
+			progressed = true;
+		return progressed;
+	}
+
+	bool idle() const {
+		return _pendingCount == 0;
+	}
+};
+
+void generateLoad(const Options& options, const std::vector<RecordedCall>& calls, int thread,
+		std::chrono::steady_clock::time_point start, ThreadResults& results) {
+	std::vector<std::unique_ptr<Connection>> connections;
+	for (int i = 0; i < options.connections; i++) {
+		int index = thread * options.connections + i;
+		connections.push_back(std::make_unique<Connection>(options, calls, start,
+				double(index) / (options.threads * options.connections), index));
+	}
+	auto end = start + std::chrono::nanoseconds(int64_t(options.duration * 1e9));
+	std::this_thread::sleep_until(start);
+	while (true) {
+		auto now = std::chrono::steady_clock::now();
+		bool sending = now < end;
+		bool progressed = false;
+		bool finished = true;
+		for (auto& connection : connections) {
+			progressed |= connection->progress(now, sending, results);
+			finished &= connection->idle();
+		}
+		if (!sending && finished)
+			break;
+		if (!progressed)
+			std::this_thread::yield(); // The server may run on the same core
+	}
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string_view name = argv[i];
+		std::string value = argv[i + 1];
+		if (name == "--host")
+			options.host = value;
+		else if (name == "--port")
+			options.port = value;
+		else if (name == "--protocol")
+			options.protocol = value;
+		else if (name == "--path")
+			options.path = value;
+		else if (name == "--requests")
+			options.requests = value;
+		else if (name == "--threads")
+			options.threads = std::stoi(value);
+		else if (name == "--connections")
+			options.connections = std::stoi(value);
+		else if (name == "--depth")
+			options.depth = std::stoi(value);
+		else if (name == "--rate")
+			options.rate = std::stod(value);
+		else if (name == "--duration")
+			options.duration = std::stod(value);
+		else {
+			std::cerr << "Unknown option " << name << std::endl;
+			return 1;
+		}
+	}
+	if (options.threads < 1 || options.connections < 1 || options.depth < 1) {
+		std::cerr << "There must be at least one thread, connection and request in flight" << std::endl;
+		return 1;
+	}
+
+	try {
+		std::vector<RecordedCall> calls;
+		if (options.protocol == "jsonrpc") {
+			if (options.requests.empty()) {
+				std::cerr << "JSON-RPC calls to replay must be given with --requests" << std::endl;
+				return 1;
+			}
+			calls = readCalls(options.requests);
+		} else if (options.protocol != "http") {
+			std::cerr << "Unknown protocol " << options.protocol << std::endl;
+			return 1;
+		}
+
+		std::vector<ThreadResults> results(options.threads);
+		auto start = std::chrono::steady_clock::now() + std::chrono::milliseconds(100); // Time to start all threads
+		{
+			std::vector<std::jthread> threads;
+			for (int i = 0; i < options.threads; i++) {
+				threads.emplace_back([&, i] {
+					try {
+						generateLoad(options, calls, i, start, results[i]);
+					} catch (std::exception& error) {
+						std::cerr << "Thread " << i << " failed: " << error.what() << std::endl;
+						results[i].errors++;
+					}
+				});
+			}
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		LatencySnapshot latency;
+		int64_t errors = 0;
+		for (ThreadResults& result : results) {
+			result.latency.addTo(latency);
+			errors += result.errors;
+		}
+
+		std::string written;
+		{
+			typename BasicJson<std::string>::Output json(written);
+			auto root = json.writeObject();
+			root.writeString("protocol", options.protocol);
+			root.writeString("mode", options.rate > 0 ? "open loop" : "closed loop");
+			root.writeInt("threads", options.threads);
+			root.writeInt("connections", options.threads * options.connections);
+			root.writeInt("depth", options.depth);
+			root.writeFloat("target_rate", options.rate);
+			root.writeFloat("seconds", seconds);
+			root.writeInt("requests", latency.count());
+			root.writeInt("errors", errors);
+			root.writeFloat("requests_per_second", latency.count() / seconds);
+			auto latencyObject = root.writeObject("latency_ns");
+			latencyObject.writeInt("mean", latency.mean().count());
+			latencyObject.writeInt("p50", latency.percentile(0.5).count());
+			latencyObject.writeInt("p90", latency.percentile(0.9).count());
+			latencyObject.writeInt("p99", latency.percentile(0.99).count());
+			latencyObject.writeInt("p999", latency.percentile(0.999).count());
+			latencyObject.writeInt("p9999", latency.percentile(0.9999).count());
+			latencyObject.writeInt("max", latency.max().count());
+		}
+		std::cout << written << std::endl;
+	} catch (std::exception& error) {
+		std::cerr << error.what() << std::endl;
+		return 1;
+	}
+}
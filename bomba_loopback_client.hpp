@@ -0,0 +1,74 @@
+#ifndef BOMBA_LOOPBACK_CLIENT
+#define BOMBA_LOOPBACK_CLIENT
+
+#ifndef BOMBA_CORE // Needed to run in godbolt
+#include "bomba_core.hpp"
+#endif
+#include "bomba_response_matcher.hpp"
+
+#include <vector>
+
+namespace Bomba {
+
+// Client that passes requests directly to a session of a server's responder in the same process and takes responses from it,
+// without any sockets. Requests are answered when written, so responses are always available when looked for.
+template <typename Responder>
+class LoopbackClient : public ITcpClient {
+	typename Responder::Session _session;
+	std::vector<char> _requests; // Incomplete requests written so far
+	Detail::ResponseMatcher _matcher; // Holds the responses that were not read yet
+	bool _disconnected = false;
+
+	// Returns if the response was found
+	template <typename Reader>
+	bool searchRequests(RequestToken tokenSought, Reader&& reader) {
+		return _matcher.takeStored(tokenSought, reader) || _matcher.processReceived(reader);
+	}
+
+public:
+	LoopbackClient(Responder& responder) : _session(responder.getSession()) {}
+
+	void writeRequest(std::span<char> written) override {
+		if (_disconnected) [[unlikely]]
+			remoteError("Connection closed by the server");
+		// Copied, because the server may modify the request while parsing it
+		_requests.insert(_requests.end(), written.begin(), written.end());
+		int64_t processed = 0;
+		while (processed < std::ssize(_requests)) {
+			auto [reaction, parsed] = _session.respond(std::span<char>(_requests).subspan(processed),
+					[this] (std::span<const char> response) {
+				std::vector<char>& received = _matcher.received();
+				received.insert(received.end(), response.begin(), response.end());
+			});
+			if (reaction == ServerReaction::DISCONNECT) [[unlikely]] {
+				_disconnected = true;
+				_requests.clear();
+				return;
+			}
+			if (reaction != ServerReaction::OK)
+				break;
+			processed += parsed;
+		}
+		_requests.erase(_requests.begin(), _requests.begin() + processed);
+	}
+
+	void getResponse(RequestToken token, Callback<std::tuple<ServerReaction, RequestToken, int64_t>
+					(std::span<char> input, bool identified)> reader) override {
+		// The server has already answered everything it could, waiting would not help
+		if (!searchRequests(token, reader)) [[unlikely]]
+			remoteError(_disconnected ? "Connection closed by the server" : "The server did not respond");
+	}
+
+	void tryToGetResponse(RequestToken token, Callback<std::tuple<ServerReaction, RequestToken, int64_t>
+					(std::span<char> input, bool identified)> reader) override {
+		searchRequests(token, reader);
+	}
+
+	// Tells if there are any responses that were not read yet
+	bool hasReceivedData() const {
+		return _matcher.hasData();
+	}
+};
+
+} // namespace Bomba
+#endif // BOMBA_LOOPBACK_CLIENT
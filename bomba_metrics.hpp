@@ -0,0 +1,208 @@
+#ifndef BOMBA_METRICS
+#define BOMBA_METRICS
+
+#ifndef BOMBA_CORE // Needed to run in godbolt
+#include "bomba_core.hpp"
+#endif
+#ifndef BOMBA_JSON
+#include "bomba_json.hpp"
+#endif
+#ifndef BOMBA_HTTP
+#include "bomba_http.hpp"
+#endif
+#ifndef BOMBA_TCP_SERVER_HPP
+#include "bomba_tcp_server.hpp"
+#endif
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <charconv>
+
+namespace Bomba {
+
+// Serves statistics of servers in Prometheus' text format at the given path and as JSON at the same path with .json appended,
+// other paths are passed to another responder. The servers' counters are only read, so serving them doesn't slow them down.
+class MetricsGetResponder : public IHttpGetResponder {
+	struct Source {
+		std::string name;
+		void* server;
+		TcpServerMetrics (*read)(void* server);
+	};
+	std::vector<Source> _sources;
+	IHttpGetResponder& _other;
+	std::string _path;
+	std::string _jsonPath;
+
+	struct Counter {
+		std::string_view name; // In Prometheus' format, a name can repeat with different labels
+		std::string_view jsonName;
+		std::string_view type;
+		std::string_view help;
+		int64_t TcpServerMetrics::* value;
+		std::string_view label; // Empty if there are no labels other than the server
+	};
+	constexpr static std::array<Counter, 10> counters = {{
+		{ "bomba_sessions", "sessions", "gauge", "Open connections", &TcpServerMetrics::sessions },
+		{ "bomba_connections_accepted_total", "accepted", "counter", "Accepted connections", &TcpServerMetrics::accepted },
+		{ "bomba_connections_refused_total", "refused", "counter", "Connections closed because of the connection limit",
+				&TcpServerMetrics::refused },
+		{ "bomba_connections_closed_total", "closed", "counter", "Closed connections", &TcpServerMetrics::closed },
+		{ "bomba_received_bytes_total", "bytesReceived", "counter", "Bytes received", &TcpServerMetrics::bytesReceived },
+		{ "bomba_sent_bytes_total", "bytesSent", "counter", "Bytes sent", &TcpServerMetrics::bytesSent },
+		{ "bomba_errors_total", "rejected", "counter", "Connections closed because of an error", &TcpServerMetrics::rejected,
+				"reason=\"rejected\"" },
+		{ "bomba_errors_total", "tooLong", "counter", "", &TcpServerMetrics::tooLong, "reason=\"too_long\"" },
+		{ "bomba_errors_total", "timedOut", "counter", "", &TcpServerMetrics::timedOut, "reason=\"timeout\"" },
+		{ "bomba_grown_buffers_total", "grownBuffers", "counter", "Messages too large for a block of the receive buffer pool",
+				&TcpServerMetrics::grownBuffers },
+	}};
+	struct Quantile {
+		double fraction;
+		std::string_view label;
+		std::string_view jsonName;
+	};
+	constexpr static std::array<Quantile, 5> quantiles = {{
+		{ 0.5, "quantile=\"0.5\"", "p50" },
+		{ 0.9, "quantile=\"0.9\"", "p90" },
+		{ 0.99, "quantile=\"0.99\"", "p99" },
+		{ 0.999, "quantile=\"0.999\"", "p999" },
+		{ 1, "quantile=\"1\"", "max" },
+	}};
+	static inline DummyGetResponder dummyGetResponderInstance = {};
+
+	template <typename Number>
+	static void writeNumber(GeneralisedBuffer& output, Number value) {
+		std::array<char, 32> bytes = {};
+		auto written = std::to_chars(bytes.data(), bytes.data() + bytes.size(), value);
+		output += std::string_view(bytes.data(), written.ptr);
+	}
+
+	static void writeSeconds(GeneralisedBuffer& output, std::chrono::nanoseconds duration) {
+		writeNumber(output, duration.count() / 1e9);
+	}
+
+	static void writeHeader(GeneralisedBuffer& output, std::string_view name, std::string_view type, std::string_view help) {
+		output += "# HELP ";
+		output += name;
+		output += ' ';
+		output += help;
+		output += "\n# TYPE ";
+		output += name;
+		output += ' ';
+		output += type;
+		output += '\n';
+	}
+
+	static void writeSample(GeneralisedBuffer& output, std::string_view name, const Source& source, std::string_view label) {
+		output += name;
+		output += "{server=\"";
+		output += std::string_view(source.name);
+		output += '"';
+		if (!label.empty()) {
+			output += ',';
+			output += label;
+		}
+		output += "} ";
+	}
+
+	void writePrometheus(GeneralisedBuffer& output, const std::vector<TcpServerMetrics>& metrics) {
+		for (const Counter& counter : counters) {
+			if (!counter.help.empty())
+				writeHeader(output, counter.name, counter.type, counter.help);
+			for (int i = 0; i < std::ssize(_sources); i++) {
+				writeSample(output, counter.name, _sources[i], counter.label);
+				writeNumber(output, metrics[i].*counter.value);
+				output += '\n';
+			}
+		}
+
+		writeHeader(output, "bomba_requests_total", "counter", "Processed requests");
+		for (int i = 0; i < std::ssize(_sources); i++) {
+			writeSample(output, "bomba_requests_total", _sources[i], {});
+			writeNumber(output, metrics[i].latency.count());
+			output += '\n';
+		}
+
+		writeHeader(output, "bomba_response_time_seconds", "summary", "Time spent processing a request");
+		for (int i = 0; i < std::ssize(_sources); i++) {
+			for (const Quantile& quantile : quantiles) {
+				writeSample(output, "bomba_response_time_seconds", _sources[i], quantile.label);
+				writeSeconds(output, metrics[i].latency.percentile(quantile.fraction));
+				output += '\n';
+			}
+			writeSample(output, "bomba_response_time_seconds_sum", _sources[i], {});
+			writeSeconds(output, metrics[i].latency.sum());
+			output += '\n';
+			writeSample(output, "bomba_response_time_seconds_count", _sources[i], {});
+			writeNumber(output, metrics[i].latency.count());
+			output += '\n';
+		}
+
+		writeHeader(output, "bomba_expanding_buffer_heap_fallbacks_total", "counter",
+				"Buffers that outgrew their preallocated part, in the whole process");
+		output += "bomba_expanding_buffer_heap_fallbacks_total ";
+		writeNumber(output, expandingBufferHeapFallbacks.load(std::memory_order_relaxed));
+		output += '\n';
+	}
+
+	void writeJson(GeneralisedBuffer& output, const std::vector<TcpServerMetrics>& metrics) {
+		typename BasicJson<std::string, GeneralisedBuffer>::Output json(output);
+		auto root = json.writeObject();
+		{
+			auto servers = root.writeObject("servers");
+			for (int i = 0; i < std::ssize(_sources); i++) {
+				auto server = servers.writeObject(_sources[i].name);
+				for (const Counter& counter : counters) {
+					server.writeInt(counter.jsonName, metrics[i].*counter.value);
+				}
+				server.writeInt("requests", metrics[i].latency.count());
+				auto latency = server.writeObject("responseTimeNanoseconds");
+				latency.writeInt("mean", metrics[i].latency.mean().count());
+				for (const Quantile& quantile : quantiles) {
+					latency.writeInt(quantile.jsonName, metrics[i].latency.percentile(quantile.fraction).count());
+				}
+			}
+		}
+		root.writeInt("expandingBufferHeapFallbacks", expandingBufferHeapFallbacks.load(std::memory_order_relaxed));
+	}
+
+public:
+	MetricsGetResponder(IHttpGetResponder& other = dummyGetResponderInstance, std::string_view path = "/metrics")
+			: _other(other), _path(path), _jsonPath(_path + ".json") {}
+
+	// The name is used as a label, it should identify the protocol the server serves, like "http" or "binary".
+	// The server must outlive this object and servers can't be added while it's already serving metrics.
+	template <typename Server>
+	void addServer(std::string_view name, Server& server) {
+		_sources.push_back({std::string(name), &server, [] (void* server) -> TcpServerMetrics {
+			return static_cast<Server*>(server)->metrics();
+		}});
+	}
+
+	bool get(std::string_view path, IWriteStarter& writeResponse) override {
+		bool json = (path == _jsonPath);
+		if (!json && path != _path)
+			return _other.get(path, writeResponse);
+
+		std::vector<TcpServerMetrics> metrics;
+		metrics.reserve(_sources.size());
+		for (const Source& source : _sources) {
+			metrics.push_back(source.read(source.server));
+		}
+		if (json) {
+			writeResponse.writeUnknownSize("application/json", [&] (GeneralisedBuffer& output) {
+				writeJson(output, metrics);
+			});
+		} else {
+			writeResponse.writeUnknownSize("text/plain; version=0.0.4", [&] (GeneralisedBuffer& output) {
+				writePrometheus(output, metrics);
+			});
+		}
+		return true;
+	}
+};
+
+} // namespace Bomba
+#endif // BOMBA_METRICS
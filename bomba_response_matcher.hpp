@@ -0,0 +1,89 @@
+#ifndef BOMBA_RESPONSE_MATCHER_HPP
+#define BOMBA_RESPONSE_MATCHER_HPP
+
+#ifndef BOMBA_CORE // Needed to run in godbolt
+#include "bomba_core.hpp"
+#endif
+
+#include <vector>
+#include <unordered_map>
+
+namespace Bomba {
+namespace Detail {
+
+// Finds the response a client looks for in the data it received, responses to other requests found meanwhile are stored
+// until they are looked for. Clients of all transports use it, they differ only in how they receive the data.
+class ResponseMatcher {
+	std::unordered_map<RequestToken, std::vector<char>> _stored;
+	std::vector<char> _received; // Received data that was not processed yet, may start with an incomplete response
+
+public:
+	// Gives the reader the response if it was stored before, returns true if the reader took it
+	template <typename Reader>
+	bool takeStored(RequestToken token, Reader&& reader) {
+		auto found = _stored.find(token);
+		if (found == _stored.end())
+			return false;
+		auto [reaction, tokenReceived, position] = reader(found->second, true);
+		if (reaction == ServerReaction::OK || reaction == ServerReaction::DISCONNECT) {
+			_stored.erase(found);
+			return true;
+		}
+		if (reaction == ServerReaction::READ_ON)
+			logicError("First it was WRONG_REPLY, now it is READ_ON?");
+		return false;
+	}
+
+	// Data received from a stream is appended here before calling processReceived()
+	std::vector<char>& received() {
+		return _received;
+	}
+
+	// Goes through the received data until the reader takes a response, an incomplete response is kept until the rest arrives.
+	// Returns true if the reader took a response or rejected the data.
+	template <typename Reader>
+	bool processReceived(Reader&& reader) {
+		int64_t processed = 0;
+		bool finished = false;
+		while (processed < std::ssize(_received)) {
+			auto [reaction, tokenReceived, position] = reader(std::span<char>(_received).subspan(processed), false);
+			if (reaction == ServerReaction::READ_ON)
+				break;
+			if (reaction == ServerReaction::DISCONNECT) {
+				finished = true;
+				break;
+			}
+			if (reaction == ServerReaction::WRONG_REPLY) {
+				_stored.insert(std::make_pair(tokenReceived, std::vector<char>(_received.begin() + processed,
+						_received.begin() + processed + position)));
+			}
+			processed += position;
+			if (reaction == ServerReaction::OK) {
+				finished = true;
+				break;
+			}
+		}
+		_received.erase(_received.begin(), _received.begin() + processed);
+		return finished;
+	}
+
+	// For transports delivering each message whole and separately, an incomplete message is dropped.
+	// Returns true if the reader took the response or rejected the message.
+	template <typename Reader>
+	bool processMessage(std::span<char> message, Reader&& reader) {
+		auto [reaction, tokenReceived, position] = reader(message, false);
+		if (reaction == ServerReaction::OK || reaction == ServerReaction::DISCONNECT)
+			return true;
+		if (reaction == ServerReaction::WRONG_REPLY)
+			_stored.insert(std::make_pair(tokenReceived, std::vector<char>(message.begin(), message.end())));
+		return false;
+	}
+
+	bool hasData() const {
+		return !_stored.empty() || !_received.empty();
+	}
+};
+
+} // namespace Detail
+} // namespace Bomba
+#endif // BOMBA_RESPONSE_MATCHER_HPP
@@ -441,6 +441,7 @@ struct RpcLambdaInformationHolder {
 			}
 
 			if (arguments) {
+				BOMBA_TRACE_SCOPE("argument deserialisation");
 				arguments->readObject(SerialisationFlags::Flags(Flags | SerialisationFlags::OBJECT_LAYOUT_KNOWN),
 									  [&] (std::optional<std::string_view> nextName, int index) {
 					if constexpr(usesParent()) {
@@ -451,14 +452,25 @@ struct RpcLambdaInformationHolder {
 					return (nextName.has_value() || index < argsSize);
 				});
 			}
+			RpcCallTimer::argumentsParsed();
 
 			if constexpr(std::is_same_v<Returned, void>) {
-				callInternal(std::make_index_sequence<argsSize>(), nullptr, input);
+				{
+					BOMBA_TRACE_SCOPE("lambda call");
+					callInternal(std::make_index_sequence<argsSize>(), nullptr, input);
+				}
+				RpcCallTimer::executed();
+				BOMBA_TRACE_SCOPE("serialisation");
 				introduceResult();
 				result.writeNull(Flags);
 			} else {
 				Returned returned;
-				callInternal(std::make_index_sequence<argsSize>(), &returned, input);
+				{
+					BOMBA_TRACE_SCOPE("lambda call");
+					callInternal(std::make_index_sequence<argsSize>(), &returned, input);
+				}
+				RpcCallTimer::executed();
+				BOMBA_TRACE_SCOPE("serialisation");
 				introduceResult();
 				TypedSerialiser<Returned>::serialiseMember(result, returned, Flags);
 			}
@@ -0,0 +1,94 @@
+#ifndef BOMBA_RPC_STATISTICS
+#define BOMBA_RPC_STATISTICS
+
+#ifndef BOMBA_CORE // Needed to run in godbolt
+#include "bomba_core.hpp"
+#endif
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+#include <algorithm>
+
+namespace Bomba {
+
+// Counts calls of each method and sums the times of their stages, can be set as the call observer of any number of servers.
+// Methods are told apart by their addresses, their paths are stored when they are called for the first time, so the methods
+// may be destroyed before the statistics (a method created later at the same address is counted as the destroyed one).
+class RpcStatistics : public IRpcCallObserver {
+	struct Counters {
+		std::string path;
+		std::atomic<int64_t> calls = 0;
+		std::atomic<int64_t> errors = 0;
+		std::atomic<int64_t> parsing = 0; // In nanoseconds
+		std::atomic<int64_t> execution = 0;
+		std::atomic<int64_t> serialisation = 0;
+	};
+	std::unordered_map<const IRemoteCallable*, std::unique_ptr<Counters>> _methods;
+	mutable std::shared_mutex _lock; // Taken exclusively only when a method is called for the first time
+
+	Counters& countersOf(const IRemoteCallable* method) {
+		{
+			std::shared_lock lock(_lock);
+			auto found = _methods.find(method);
+			if (found != _methods.end()) [[likely]]
+				return *found->second;
+		}
+		std::unique_lock lock(_lock);
+		auto& added = _methods[method];
+		if (!added) {
+			added = std::make_unique<Counters>();
+			added->path = PathWithSeparator<".">::constructPath(method);
+		}
+		return *added;
+	}
+
+public:
+	void recordCall(const IRemoteCallable* method, const RpcCallMeasurement& measurement) override {
+		Counters& counters = countersOf(method);
+		counters.calls.fetch_add(1, std::memory_order_relaxed);
+		if (measurement.failed) [[unlikely]]
+			counters.errors.fetch_add(1, std::memory_order_relaxed);
+		counters.parsing.fetch_add(measurement.parsing.count(), std::memory_order_relaxed);
+		counters.execution.fetch_add(measurement.execution.count(), std::memory_order_relaxed);
+		counters.serialisation.fetch_add(measurement.serialisation.count(), std::memory_order_relaxed);
+	}
+
+	// Statistics of all methods called so far, sorted by their paths
+	std::vector<RpcMethodStatistics> snapshot() const {
+		std::vector<RpcMethodStatistics> result;
+		{
+			std::shared_lock lock(_lock);
+			result.reserve(_methods.size());
+			for (auto& [method, counters] : _methods) {
+				result.push_back({counters->path,
+						counters->calls.load(std::memory_order_relaxed),
+						counters->errors.load(std::memory_order_relaxed),
+						std::chrono::nanoseconds(counters->parsing.load(std::memory_order_relaxed)),
+						std::chrono::nanoseconds(counters->execution.load(std::memory_order_relaxed)),
+						std::chrono::nanoseconds(counters->serialisation.load(std::memory_order_relaxed))});
+			}
+		}
+		std::sort(result.begin(), result.end(), [] (const RpcMethodStatistics& first, const RpcMethodStatistics& second) {
+			return first.path < second.path;
+		});
+		return result;
+	}
+
+	// Sets all counts and durations to zero, calls that happen meanwhile may be counted partially
+	void reset() {
+		std::shared_lock lock(_lock);
+		for (auto& [method, counters] : _methods) {
+			for (std::atomic<int64_t>* counter : {&counters->calls, &counters->errors, &counters->parsing,
+					&counters->execution, &counters->serialisation}) {
+				counter->store(0, std::memory_order_relaxed);
+			}
+		}
+	}
+};
+
+} // namespace Bomba
+#endif // BOMBA_RPC_STATISTICS
@@ -0,0 +1,375 @@
+#ifndef BOMBA_SHARED_MEMORY_HPP
+#define BOMBA_SHARED_MEMORY_HPP
+
+#ifndef BOMBA_CORE // Needed to run in godbolt
+#include "bomba_core.hpp"
+#endif
+#include "bomba_response_matcher.hpp"
+
+#include <vector>
+#include <string>
+#include <span>
+#include <algorithm>
+#include <optional>
+#include <bit>
+#include <atomic>
+#include <thread>
+#include <system_error>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <new>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+namespace Bomba {
+
+namespace Detail {
+
+// One direction of a stream between two processes, one of them only writes and the other one only reads. Positions only grow,
+// the capacity is a power of two. Either side first spins for a while when it has to wait, then sleeps on a futex.
+struct SharedRing {
+	alignas(64) std::atomic<uint64_t> head = 0; // Written by the producer
+	std::atomic<uint32_t> dataSignal = 0; // Changed whenever data is added
+	std::atomic<uint32_t> consumerSleeping = 0;
+	alignas(64) std::atomic<uint64_t> tail = 0; // Written by the consumer
+	std::atomic<uint32_t> spaceSignal = 0; // Changed whenever data is removed
+	std::atomic<uint32_t> producerSleeping = 0;
+	alignas(64) uint64_t capacity = 0;
+
+	// Spinning on a single core only delays the other side
+	static int defaultSpins() {
+		return std::thread::hardware_concurrency() > 1 ? 4096 : 0;
+	}
+
+	static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+			"Atomics in shared memory must not use locks");
+
+	char* data() {
+		return reinterpret_cast<char*>(this + 1);
+	}
+
+	static void sleep(std::atomic<uint32_t>& signal, uint32_t expected) {
+		timespec limit = {0, 100'000'000}; // To check periodically if the process should stop waiting
+		::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&signal), FUTEX_WAIT, expected, &limit, nullptr, 0);
+	}
+
+	static void wake(std::atomic<uint32_t>& signal, std::atomic<uint32_t>& sleeping) {
+		signal.fetch_add(1, std::memory_order_seq_cst);
+		if (sleeping.load(std::memory_order_seq_cst)) [[unlikely]]
+			::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&signal), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+	}
+
+	// Returns false if it stopped waiting because the condition to give up became true
+	template <typename Ready, typename GiveUp>
+	static bool wait(Ready&& ready, std::atomic<uint32_t>& signal, std::atomic<uint32_t>& sleeping, int spins, GiveUp&& giveUp) {
+		auto pause = [] {
+#if defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+#endif
+		};
+		if (spins < 0) { // Polls without ever sleeping
+			while (!ready()) {
+				if (giveUp()) [[unlikely]]
+					return false;
+				pause();
+			}
+			return true;
+		}
+		while (true) {
+			for (int i = 0; i < spins; i++) {
+				if (ready())
+					return true;
+				if (giveUp()) [[unlikely]]
+					return false;
+				pause();
+			}
+			uint32_t expected = signal.load(std::memory_order_seq_cst);
+			sleeping.store(1, std::memory_order_seq_cst);
+			if (ready()) {
+				sleeping.store(0, std::memory_order_relaxed);
+				return true;
+			}
+			if (giveUp()) [[unlikely]] {
+				sleeping.store(0, std::memory_order_relaxed);
+				return false;
+			}
+			sleep(signal, expected);
+			sleeping.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	// Writes everything, waiting for the consumer to free the space if needed
+	template <typename GiveUp>
+	bool write(std::span<const char> written, int spins, GiveUp&& giveUp) {
+		uint64_t position = head.load(std::memory_order_relaxed);
+		while (!written.empty()) {
+			uint64_t free = capacity - (position - tail.load(std::memory_order_acquire));
+			if (free == 0) {
+				if (!wait([&] { return tail.load(std::memory_order_seq_cst) != position - capacity; },
+						spaceSignal, producerSleeping, spins, giveUp))
+					return false;
+				continue;
+			}
+			uint64_t offset = position & (capacity - 1);
+			uint64_t size = std::min<uint64_t>({free, written.size(), capacity - offset});
+			memcpy(data() + offset, written.data(), size);
+			position += size;
+			written = written.subspan(size);
+			head.store(position, std::memory_order_seq_cst);
+			wake(dataSignal, consumerSleeping);
+		}
+		return true;
+	}
+
+	bool empty() {
+		return head.load(std::memory_order_seq_cst) == tail.load(std::memory_order_relaxed);
+	}
+
+	// Appends all data that is available without waiting
+	void readAvailable(std::vector<char>& into) {
+		uint64_t position = tail.load(std::memory_order_relaxed);
+		uint64_t end = head.load(std::memory_order_acquire);
+		while (position < end) {
+			uint64_t offset = position & (capacity - 1);
+			uint64_t size = std::min<uint64_t>(end - position, capacity - offset);
+			into.insert(into.end(), data() + offset, data() + offset + size);
+			position += size;
+		}
+		tail.store(position, std::memory_order_seq_cst);
+		wake(spaceSignal, producerSleeping);
+	}
+
+	template <typename GiveUp>
+	bool waitForData(int spins, GiveUp&& giveUp) {
+		return wait([this] { return !empty(); }, dataSignal, consumerSleeping, spins, giveUp);
+	}
+};
+
+// The file contains the header, the ring of requests and the ring of responses
+struct alignas(64) SharedMemoryLayout {
+	constexpr static uint64_t Magic = 0x4252'5041'4d4f'4242; // Arbitrary, written last to mark the file as ready
+	uint64_t magic = 0;
+	uint64_t ringCapacity = 0;
+	uint64_t serverAlive = 0; // Cleared when the server stops, so that the client doesn't wait for it forever
+
+	bool isServerAlive() {
+		return std::atomic_ref<uint64_t>(serverAlive).load(std::memory_order_relaxed);
+	}
+
+	static int64_t ringSize(int64_t capacity) {
+		return sizeof(SharedRing) + capacity;
+	}
+	static int64_t fileSize(int64_t capacity) {
+		return sizeof(SharedMemoryLayout) + 2 * ringSize(capacity);
+	}
+	SharedRing& requests() {
+		return *reinterpret_cast<SharedRing*>(reinterpret_cast<char*>(this) + sizeof(SharedMemoryLayout));
+	}
+	SharedRing& responses() {
+		return *reinterpret_cast<SharedRing*>(reinterpret_cast<char*>(this) + sizeof(SharedMemoryLayout) + ringSize(ringCapacity));
+	}
+};
+
+inline void* mapSharedFile(int file, int64_t size, const std::string& path) {
+	void* mapped = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+	if (mapped == MAP_FAILED) [[unlikely]] {
+		int error = errno;
+		::close(file);
+		throw std::system_error(error, std::system_category(), "mapping " + path);
+	}
+	::close(file); // The mapping keeps the file
+	return mapped;
+}
+
+} // namespace Detail
+
+// Serves one client in another process on the same machine through a pair of rings in a shared file (best placed in /dev/shm).
+// The file is created by the server and removed when the server is destroyed. There is only one session, so a client
+// must connect only after the previous one is destroyed and there is no message left unfinished.
+template <typename Responder>
+class SharedMemoryServer {
+	Responder& _responder;
+	std::string _path;
+	Detail::SharedMemoryLayout* _layout = nullptr;
+	int64_t _mappedSize = 0;
+	std::optional<typename Responder::Session> _session;
+	std::vector<char> _input;
+	std::vector<char> _output;
+	std::atomic<bool> _stopped = false;
+	int _spins = Detail::SharedRing::defaultSpins();
+
+	void processAvailable() {
+		_layout->requests().readAvailable(_input);
+		int64_t processed = 0;
+		while (processed < std::ssize(_input)) {
+			auto [reaction, parsed] = _session->respond(std::span<char>(_input).subspan(processed), [this] (std::span<const char> response) {
+				_output.insert(_output.end(), response.begin(), response.end());
+			});
+			if (reaction == ServerReaction::DISCONNECT) [[unlikely]] {
+				// There's no connection to close, the rest of the stream can't be understood
+				processed = _input.size();
+				_session.emplace(_responder.getSession());
+				break;
+			}
+			if (reaction != ServerReaction::OK)
+				break;
+			processed += parsed;
+		}
+		_input.erase(_input.begin(), _input.begin() + processed);
+		if (!_output.empty()) {
+			_layout->responses().write(_output, _spins, [this] { return _stopped.load(std::memory_order_relaxed); });
+			_output.clear();
+		}
+	}
+
+public:
+	// The capacity of each ring is rounded up to a power of two
+	SharedMemoryServer(Responder& responder, std::string path, int64_t ringCapacity = 1 << 20)
+			: _responder(responder), _path(std::move(path)) {
+		_session.emplace(responder.getSession());
+		ringCapacity = std::bit_ceil(uint64_t(std::max<int64_t>(ringCapacity, 4096)));
+		int file = ::open(_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		if (file < 0) [[unlikely]]
+			throw std::system_error(errno, std::system_category(), "creating " + _path);
+		_mappedSize = Detail::SharedMemoryLayout::fileSize(ringCapacity);
+		if (::ftruncate(file, _mappedSize) < 0) [[unlikely]] {
+			int error = errno;
+			::close(file);
+			throw std::system_error(error, std::system_category(), "resizing " + _path);
+		}
+		void* mapped = Detail::mapSharedFile(file, _mappedSize, _path);
+		_layout = new (mapped) Detail::SharedMemoryLayout();
+		_layout->ringCapacity = ringCapacity;
+		new (&_layout->requests()) Detail::SharedRing();
+		_layout->requests().capacity = ringCapacity;
+		new (&_layout->responses()) Detail::SharedRing();
+		_layout->responses().capacity = ringCapacity;
+		_layout->serverAlive = 1;
+		std::atomic_ref<uint64_t>(_layout->magic).store(Detail::SharedMemoryLayout::Magic, std::memory_order_release);
+	}
+
+	SharedMemoryServer(const SharedMemoryServer&) = delete;
+	SharedMemoryServer& operator=(const SharedMemoryServer&) = delete;
+
+	~SharedMemoryServer() {
+		stopRunning();
+		::munmap(_layout, _mappedSize);
+		::unlink(_path.c_str());
+	}
+
+	// Waits for requests and responds to them until stopRunning() is called
+	void run() {
+		auto stopped = [this] { return _stopped.load(std::memory_order_relaxed); };
+		while (_layout->requests().waitForData(_spins, stopped))
+			processAvailable();
+	}
+
+	// Responds to the requests that were already received
+	void runARound() {
+		if (!_layout->requests().empty())
+			processAvailable();
+	}
+
+	void stopRunning() {
+		_stopped = true;
+		std::atomic_ref<uint64_t>(_layout->serverAlive).store(0, std::memory_order_seq_cst);
+		Detail::SharedRing& requests = _layout->requests();
+		Detail::SharedRing::wake(requests.dataSignal, requests.consumerSleeping);
+		// The client may be waiting for a response or for space to write a request
+		Detail::SharedRing::wake(requests.spaceSignal, requests.producerSleeping);
+		Detail::SharedRing& responses = _layout->responses();
+		Detail::SharedRing::wake(responses.dataSignal, responses.consumerSleeping);
+	}
+
+	// How many times to check for data before sleeping, a negative number means never sleeping, which gives the lowest
+	// latency at the cost of keeping a core busy
+	void setSpins(int spins) {
+		_spins = spins;
+	}
+};
+
+// Client for SharedMemoryServer, must be created after the server. Calls fail with RemoteError once the server is stopped
+// or destroyed, but a server process that is killed can't tell the client.
+class SharedMemoryClient : public ITcpClient {
+	Detail::SharedMemoryLayout* _layout = nullptr;
+	int64_t _mappedSize = 0;
+	Detail::ResponseMatcher _matcher;
+	int _spins = Detail::SharedRing::defaultSpins();
+
+	auto serverStopped() {
+		return [this] { return !_layout->isServerAlive(); };
+	}
+
+	template <bool doWait, typename Reader>
+	void searchRequests(RequestToken tokenSought, Reader&& reader) {
+		if (_matcher.takeStored(tokenSought, reader))
+			return;
+		Detail::SharedRing& responses = _layout->responses();
+		// Data read before may contain the response already
+		while (!_matcher.processReceived(reader)) {
+			if constexpr(!doWait) {
+				if (responses.empty())
+					return;
+			} else {
+				if (!responses.waitForData(_spins, serverStopped()) && responses.empty()) [[unlikely]] {
+					remoteError("The shared memory server stopped");
+					return;
+				}
+			}
+			responses.readAvailable(_matcher.received());
+		}
+	}
+
+public:
+	SharedMemoryClient(const std::string& path) {
+		int file = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+		if (file < 0) [[unlikely]]
+			throw std::system_error(errno, std::system_category(), "opening " + path);
+		Detail::SharedMemoryLayout header;
+		if (::pread(file, &header, sizeof(header), 0) != sizeof(header) || header.magic != Detail::SharedMemoryLayout::Magic) {
+			::close(file);
+			throw std::system_error(std::make_error_code(std::errc::invalid_argument), path + " is not ready for clients");
+		}
+		_mappedSize = Detail::SharedMemoryLayout::fileSize(header.ringCapacity);
+		_layout = reinterpret_cast<Detail::SharedMemoryLayout*>(Detail::mapSharedFile(file, _mappedSize, path));
+	}
+
+	SharedMemoryClient(const SharedMemoryClient&) = delete;
+	SharedMemoryClient& operator=(const SharedMemoryClient&) = delete;
+
+	~SharedMemoryClient() {
+		::munmap(_layout, _mappedSize);
+	}
+
+	void writeRequest(std::span<char> written) override {
+		if (!_layout->requests().write(written, _spins, serverStopped())) [[unlikely]]
+			remoteError("The shared memory server stopped");
+	}
+
+	void getResponse(RequestToken token, Callback<std::tuple<ServerReaction, RequestToken, int64_t>
+					(std::span<char> input, bool identified)> reader) override {
+		searchRequests<true>(token, reader);
+	}
+
+	void tryToGetResponse(RequestToken token, Callback<std::tuple<ServerReaction, RequestToken, int64_t>
+					(std::span<char> input, bool identified)> reader) override {
+		searchRequests<false>(token, reader);
+	}
+
+	// Tells if a response can be read without waiting for the server, but only a part of it may have arrived yet
+	bool hasReceivedData() {
+		return _matcher.hasData() || !_layout->responses().empty();
+	}
+
+	// Same as SharedMemoryServer::setSpins()
+	void setSpins(int spins) {
+		_spins = spins;
+	}
+};
+
+} // namespace Bomba
+#endif // BOMBA_SHARED_MEMORY_HPP
@@ -4,11 +4,11 @@
 #ifndef BOMBA_CORE // Needed to run in godbolt
 #include "bomba_core.hpp"
 #endif
+#include "bomba_unix_socket.hpp"
+#include "bomba_response_matcher.hpp"
 
 #include <experimental/net>
-#include <vector>
 #include <string>
-#include <unordered_map>
 
 namespace Bomba {
 
@@ -20,51 +20,44 @@ class SyncNetworkClient : public ITcpClient {
 	Net::ip::tcp::socket _socket = Net::ip::tcp::socket{_ioContext};
 	Net::ip::tcp::resolver _resolver = Net::ip::tcp::resolver{_ioContext};
 	Net::ip::basic_endpoint<Net::ip::tcp> _server;
-	std::unordered_map<RequestToken, std::vector<char>> _responses;
-	std::vector<char> _leftovers;
+	std::string _unixSocketPath; // Empty if connecting through TCP
+	Detail::ResponseMatcher _matcher;
 	
 	void connect() {
-		_socket.connect(_server);
+		if (_unixSocketPath.empty()) [[likely]]
+			_socket.connect(_server);
+		else // The socket class only uses the handle, so it doesn't matter it's not TCP
+			_socket.assign(Net::ip::tcp::v4(), Detail::connectToUnixSocket(_unixSocketPath));
 	}
 
 	template <bool doWait, typename Reader>
 	void searchRequests(RequestToken tokenSought, Reader&& reader) {
-		// See if some response was already received
-		auto found = _responses.find(tokenSought);
-		if (found != _responses.end()) {
-			auto [reaction, token, position] = reader(found->second, true);
-			if (reaction == ServerReaction::OK || reaction == ServerReaction::DISCONNECT)
-				return;
-			if (reaction == ServerReaction::READ_ON)
-				logicError("First it was WRONG_REPLY, now it is READ_ON?");
-		}
+		if (_matcher.takeStored(tokenSought, reader) || _matcher.processReceived(reader))
+			return;
 
 		// Wait for a reply if none was received before
 		std::array<char, 2048> responseBuffer;
-		bool wasReceived = false;
-		while (!wasReceived) {
+		while (true) {
 			std::error_code error;
 			if constexpr(!doWait) {
 				if (_socket.available() == 0)
-					break;
+					return;
 			}
 			auto received = _socket.read_some(Net::buffer(responseBuffer), error);
 			if (error) {
 				remoteError(error.message().c_str());
-				break;
+				return;
 			}
-			_leftovers.insert(_leftovers.end(), responseBuffer.begin(), responseBuffer.begin() + received);
-			while (!_leftovers.empty()) {
-				auto [reaction, tokenReceived, position] = reader(_leftovers, false);
-				if (reaction == ServerReaction::OK)
-					wasReceived = true;
-				else if (reaction == ServerReaction::DISCONNECT || reaction == ServerReaction::READ_ON) {
-					return;
-				} else if (reaction == ServerReaction::WRONG_REPLY) {
-					_responses.insert(std::make_pair(tokenReceived, std::vector<char>(_leftovers.begin(), _leftovers.begin() + position)));
-				} // else read on
-				_leftovers = std::vector<char>(_leftovers.begin() + position, _leftovers.end());
+			if (received == 0) [[unlikely]] {
+				// End of stream, the server closed the connection
+				_socket.close();
+				remoteError("Connection closed by the server");
+				return;
 			}
+			std::vector<char>& unprocessed = _matcher.received();
+			unprocessed.insert(unprocessed.end(), responseBuffer.begin(), responseBuffer.begin() + received);
+			if (_matcher.processReceived(reader))
+				return;
 		}
 	}
 
@@ -72,6 +65,9 @@ public:
 	SyncNetworkClient(std::string server, std::string protocol)
 			: _server(*_resolver.resolve(server, protocol).begin()) {
 	}
+	// Connects to a server listening on a Unix domain socket on the same host
+	SyncNetworkClient(UnixSocketPath path) : _unixSocketPath(path.path) {
+	}
 	
 	void writeRequest(std::span<char> written) override {
 		if (!_socket.is_open())
@@ -89,6 +85,13 @@ public:
 		searchRequests<true>(token, reader);
 	}
 
+	// Tells if a response can be read without waiting for the server, but only a part of it may have arrived yet
+	bool hasReceivedData() {
+		if (_matcher.hasData())
+			return true;
+		return _socket.is_open() && _socket.available() > 0;
+	}
+
 	void tryToGetResponse(RequestToken token, Callback<std::tuple<ServerReaction, RequestToken, int64_t>
 					(std::span<char> input, bool identified)> reader) override {
 		searchRequests<false>(token, reader);
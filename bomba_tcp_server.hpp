@@ -4,10 +4,28 @@
 #ifndef BOMBA_CORE // Needed to run in godbolt
 #include "bomba_core.hpp"
 #endif
+#include "bomba_unix_socket.hpp"
 
 #include <experimental/net>
 #include <vector>
+#include <array>
+#include <optional>
 #include <chrono>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include <semaphore>
+#include <bit>
+#include <cmath>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #include <iostream>
 
@@ -27,262 +45,1472 @@ struct TcpReceiver {
 	virtual std::span<char> space() = 0;
 };
 
+// Blocks of memory for received data, shared by sessions of one thread so that only sessions with unprocessed input hold one
+class ReceiveBufferPool {
+	std::vector<std::unique_ptr<char[]>> _free;
+	int _allocated = 0;
+
+public:
+	constexpr static int BlockSize = 4096;
+
+	std::unique_ptr<char[]> borrow() {
+		if (_free.empty()) [[unlikely]] {
+			_allocated++;
+			return std::make_unique_for_overwrite<char[]>(BlockSize);
+		}
+		std::unique_ptr<char[]> block = std::move(_free.back());
+		_free.pop_back();
+		return block;
+	}
+
+	void giveBack(std::unique_ptr<char[]>&& block) {
+		_free.push_back(std::move(block));
+	}
+
+	// Number of blocks ever allocated, which is the largest number of sessions that had unprocessed input at once
+	int allocated() const {
+		return _allocated;
+	}
+};
+
+// A counter that only one thread increments, so it doesn't need a locked instruction, but any thread can read it
+class ThreadCounter {
+	std::atomic<int64_t> _value = 0;
+
+public:
+	void add(int64_t amount) {
+		_value.store(_value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	int64_t get() const {
+		return _value.load(std::memory_order_relaxed);
+	}
+};
+
+// Events counted by one thread of a server
+struct TcpServerCounters {
+	ThreadCounter accepted;
+	ThreadCounter refused; // Over the connection limit
+	ThreadCounter closed;
+	ThreadCounter bytesReceived;
+	ThreadCounter bytesSent;
+	ThreadCounter rejected; // The responder wanted to disconnect (ServerReaction::DISCONNECT), usually the message was malformed
+	ThreadCounter tooLong; // Messages longer than the size limit
+	ThreadCounter timedOut;
+	ThreadCounter grownBuffers; // Messages that didn't fit into a block of the receive buffer pool
+};
+
 class TcpServerBuffer : TcpReceiver {
-	constexpr static int ResponseMaxSize = 2048;
-	constexpr static int ResponseBufferSize = ResponseMaxSize * 1.5;
-	std::array<char, ResponseBufferSize> _responseArray = {};
-	std::span<char> _responseBuffer = std::span<char>(_responseArray.data(), ResponseMaxSize);
-	int _keptStart = 0; // FIXME: Can become extremely large under unknown circumstances
-	int _keptEnd = 0;
-	std::vector<char> _longLeftovers;
+	constexpr static int BlockSize = ReceiveBufferPool::BlockSize;
+	ReceiveBufferPool* _pool = nullptr; // Without a pool, a block of the basic size is kept once allocated
+	std::unique_ptr<char[]> _block; // Present only while it's needed, if there is a pool
+	int _capacity = 0; // Always a power of two, larger than the basic size only while a large message is received
+	int _start = 0; // Processed data is never touched again, consuming it only moves the start
+	int _end = 0;
+	int _maxMessageSize = DefaultMaxMessageSize;
+	TcpServerCounters* _counters = nullptr;
 
 public:
+	constexpr static int DefaultMaxMessageSize = 1 << 20;
+
 	TcpServerBuffer() = default;
+	TcpServerBuffer(ReceiveBufferPool& pool) : _pool(&pool) {}
 	virtual ~TcpServerBuffer() = default;
 
 private:
-	ServerReaction readBuffer(ITcpServerSession& session) {
-		std::span<char> input;
-		if (_longLeftovers.empty()) [[likely]] {
-			input = std::span<char>(_responseArray.begin() + _keptStart, _keptEnd - _keptStart);
+	void count(ThreadCounter TcpServerCounters::* counter) {
+		if (_counters)
+			(_counters->*counter).add(1);
+	}
+
+	void releaseBlock() {
+		if (!_block)
+			return;
+		if (_capacity != BlockSize) [[unlikely]]
+			_block.reset(); // Memory for large messages is never kept
+		else if (_pool)
+			_pool->giveBack(std::move(_block));
+		if (!_block)
+			_capacity = 0;
+	}
+
+	// Called only when the end of the buffer was reached, unprocessed data are moved only if the message is incomplete
+	void makeSpace() {
+		int kept = _end - _start;
+		if (_start >= kept) {
+			// The incomplete message fits into the space taken by processed messages
+			memcpy(_block.get(), _block.get() + _start, kept);
 		} else {
-			input = std::span<char>(_longLeftovers.begin() + _keptStart, _keptEnd - _keptStart);
+			// The message is too large, the buffer doubles, so that it's copied only a few times as it arrives
+			if (_capacity == BlockSize)
+				count(&TcpServerCounters::grownBuffers);
+			int capacity = _capacity * 2;
+			std::unique_ptr<char[]> grown = std::make_unique_for_overwrite<char[]>(capacity);
+			memcpy(grown.get(), _block.get() + _start, kept);
+			releaseBlock();
+			_block = std::move(grown);
+			_capacity = capacity;
 		}
+		_start = 0;
+		_end = kept;
+	}
 
-		auto [reaction, parsed] = session.feedToResponder(input);
+	bool processReceived(ITcpServerSession& session) {
+		return consumeProcessed(processMessages(session, unprocessed()));
+	}
 
-		if (reaction == ServerReaction::DISCONNECT) {
-			return reaction;
-		}
-		if (reaction == ServerReaction::OK) {
-			_keptStart += parsed;
+public:
+	// Lets the session process all complete messages in the data, returns how much was processed or -1 if the connection
+	// is to be closed. Doesn't touch the buffer, so the data can be processed on another thread if it's not used meanwhile.
+	static int64_t processMessages(ITcpServerSession& session, std::span<char> data) {
+		int64_t processed = 0;
+		while (processed < std::ssize(data)) {
+			auto [reaction, parsed] = session.feedToResponder(data.subspan(processed));
+			if (reaction == ServerReaction::DISCONNECT)
+				return -1;
+			if (reaction != ServerReaction::OK)
+				break;
+			session.notifyMessageWasParsed();
+			processed += parsed;
 		}
-		return reaction;
+		return processed;
 	}
 
-public:
 	virtual bool receive(ITcpServerSession& session, std::error_code error, int length) {
+		return store(error, length) && processReceived(session);
+	}
+
+	// For backends that receive into their own memory, complete messages are parsed in place and only the rest is copied
+	bool receive(ITcpServerSession& session, std::span<char> data) {
+		if (_start == _end) [[likely]] {
+			int64_t processed = processMessages(session, data);
+			if (processed < 0) [[unlikely]] {
+				count(&TcpServerCounters::rejected);
+				return false;
+			}
+			data = data.subspan(processed);
+			if (data.empty()) [[likely]]
+				return true;
+		}
+		while (!data.empty()) {
+			data = data.subspan(store(data));
+			if (!processReceived(session))
+				return false;
+		}
+		return true;
+	}
+
+	// Accepts data received into space() without processing it, returns false if the connection was closed
+	bool store(std::error_code error, int length) {
 		if (error || length == 0 /* Means end of stream */) {
 			return false;
 		}
+		_end += length;
+		return true;
+	}
 
-		_keptEnd += length;
-		if (!_longLeftovers.empty()) [[unlikely]] {
-			// Message too large for the buffer, it had to be written into the vector
-			_longLeftovers.resize(_keptEnd); // Shrink to contain only the data that was actually read
+	// Copies data without processing it, at most as much as the size limit allows, returns how much was copied
+	int64_t store(std::span<const char> data) {
+		int64_t stored = 0;
+		while (stored < std::ssize(data) && _end - _start <= _maxMessageSize) {
+			std::span<char> free = space();
+			int length = std::min<int64_t>(free.size(), std::ssize(data) - stored);
+			memcpy(free.data(), data.data() + stored, length);
+			stored += length;
+			_end += length;
 		}
+		return stored;
+	}
 
-		ServerReaction reaction = ServerReaction::OK;
-		int previousReadStart = _keptStart;
-		while ((reaction = readBuffer(session)) == ServerReaction::OK) {
-			session.notifyMessageWasParsed();
-			if (_keptStart >= _keptEnd)
-				break;
+	// Data that was received but not processed yet
+	std::span<char> unprocessed() {
+		return std::span<char>(_block.get() + _start, _end - _start);
+	}
+
+	// Discards the given amount of processed data, returns false if the unprocessed rest is longer than the size limit
+	bool consume(int64_t length) {
+		_start += length;
+		if (_start == _end) [[likely]] {
+			// Everything was processed, the memory isn't needed until more data arrives
+			_start = 0;
+			_end = 0;
+			releaseBlock();
+		} else if (_end - _start > _maxMessageSize) [[unlikely]] {
+			count(&TcpServerCounters::tooLong);
+			return false;
 		}
-		if (reaction == ServerReaction::DISCONNECT) {
+		return true;
+	}
+
+	// Discards what processMessages() processed, returns false if the connection is to be closed
+	bool consumeProcessed(int64_t processed) {
+		if (processed < 0) [[unlikely]] {
+			count(&TcpServerCounters::rejected);
 			return false;
 		}
+		return consume(processed);
+	}
+
+	// Memory for receiving more data, obtained from the pool if there was no unprocessed data
+	// It never lets a message exceed the size limit by more than one byte, so an oversized message is detected
+	// regardless of how quickly it arrives
+	std::span<char> space() {
+		if (!_block) [[unlikely]] {
+			_block = _pool ? _pool->borrow() : std::make_unique_for_overwrite<char[]>(BlockSize);
+			_capacity = BlockSize;
+		} else if (_end == _capacity) [[unlikely]] {
+			makeSpace();
+		}
+		int allowed = _maxMessageSize + 1 - (_end - _start);
+		return std::span<char>(_block.get() + _end, std::min(_capacity - _end, allowed));
+	}
+
+	// Gives back memory that isn't needed if nothing was received into the space
+	void unused() {
+		if (_start == _end)
+			releaseBlock();
+	}
+
+	// Whether a message has started arriving but isn't complete yet
+	bool incomplete() const {
+		return _start != _end;
+	}
+
+	// Forgets all received data, for reusing the buffer in another session
+	void reset(ReceiveBufferPool* pool, int maxMessageSize = DefaultMaxMessageSize, TcpServerCounters* counters = nullptr) {
+		_start = 0;
+		_end = 0;
+		releaseBlock();
+		_pool = pool;
+		_maxMessageSize = maxMessageSize;
+		_counters = counters;
+	}
+};
+
+// Time limits for sessions, zero disables a limit. A connection that doesn't send or receive anything for the idle time
+// is closed, as is one that doesn't complete a message's header or body in its time (counted from when the message
+// started arriving or when its header was complete). Responders that can't tell the body apart (their sessions don't have
+// a readingBody() method) have the whole message limited by the header time limit.
+struct TcpServerTimeouts {
+	std::chrono::milliseconds idle = {};
+	std::chrono::milliseconds header = {};
+	std::chrono::milliseconds body = {};
+};
+
+// Counts of durations in buckets that are wider for longer durations (like HdrHistogram), each power of two is split
+// into 32 buckets, so any duration is known with an error below 1/32. Can be added or subtracted.
+class LatencySnapshot {
+public:
+	constexpr static int SubBucketBits = 5;
+	constexpr static int SubBuckets = 1 << SubBucketBits;
+	constexpr static int Buckets = (65 - SubBucketBits) * SubBuckets;
+
+private:
+	std::array<uint64_t, Buckets> _counts = {};
+	uint64_t _count = 0;
+	uint64_t _sum = 0; // In nanoseconds
+	friend class LatencyHistogram;
+
+public:
+	static int bucket(uint64_t nanoseconds) {
+		if (nanoseconds < SubBuckets)
+			return nanoseconds;
+		int exponent = std::bit_width(nanoseconds) - 1 - SubBucketBits;
+		return (exponent + 1) * SubBuckets + int(nanoseconds >> exponent) - SubBuckets;
+	}
+
+	// The longest duration that falls into the bucket
+	static uint64_t highestValue(int bucket) {
+		if (bucket < SubBuckets)
+			return bucket;
+		int exponent = bucket / SubBuckets - 1;
+		uint64_t mantissa = bucket % SubBuckets + SubBuckets;
+		return ((mantissa + 1) << exponent) - 1;
+	}
+
+	int64_t count() const {
+		return _count;
+	}
+
+	std::chrono::nanoseconds sum() const {
+		return std::chrono::nanoseconds(_sum);
+	}
+
+	std::chrono::nanoseconds mean() const {
+		if (_count == 0) [[unlikely]]
+			return std::chrono::nanoseconds(0);
+		return std::chrono::nanoseconds(_sum / _count);
+	}
+
+	// The duration that the given fraction of samples didn't exceed, 0.99 gives the 99th percentile
+	std::chrono::nanoseconds percentile(double fraction) const {
+		uint64_t rank = std::max<uint64_t>(std::ceil(fraction * _count), 1);
+		uint64_t counted = 0;
+		for (int i = 0; i < Buckets; i++) {
+			counted += _counts[i];
+			if (counted >= rank)
+				return std::chrono::nanoseconds(highestValue(i));
+		}
+		return std::chrono::nanoseconds(0);
+	}
+
+	std::chrono::nanoseconds max() const {
+		return percentile(1);
+	}
+
+	LatencySnapshot& operator+=(const LatencySnapshot& other) {
+		for (int i = 0; i < Buckets; i++) {
+			_counts[i] += other._counts[i];
+		}
+		_count += other._count;
+		_sum += other._sum;
+		return *this;
+	}
+
+	LatencySnapshot& operator-=(const LatencySnapshot& other) {
+		for (int i = 0; i < Buckets; i++) {
+			_counts[i] -= other._counts[i];
+		}
+		_count -= other._count;
+		_sum -= other._sum;
+		return *this;
+	}
+};
 
-		if (!_longLeftovers.empty() && previousReadStart != _keptStart) [[unlikely]] {
-			// Something was read successfully
-			int left = _longLeftovers.size() - _keptStart;
-			if (left > std::ssize(_responseArray)) {
-				_longLeftovers.erase(_longLeftovers.begin(), _longLeftovers.begin() + _keptStart);
-				_keptEnd = left;
-				_keptStart = 0;
-			} else {
-				memcpy(_responseArray.data(), _longLeftovers.data() + _keptStart, left);
-				_keptEnd = left;
-				_keptStart = 0;
-				_longLeftovers.clear();
-				_longLeftovers.shrink_to_fit();
+// Records durations for a LatencySnapshot, recording is meant for one thread, but a snapshot can be taken from any thread
+class LatencyHistogram {
+	std::array<std::atomic<uint64_t>, LatencySnapshot::Buckets> _counts = {};
+	std::atomic<uint64_t> _sum = 0;
+
+public:
+	// Must be called only from one thread, the counters are atomic only so that they can be read from elsewhere
+	void record(std::chrono::nanoseconds duration) {
+		uint64_t value = std::max<int64_t>(duration.count(), 0);
+		std::atomic<uint64_t>& counter = _counts[LatencySnapshot::bucket(value)];
+		counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		_sum.store(_sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	// Slower, but can be called from multiple threads at once
+	void recordConcurrently(std::chrono::nanoseconds duration) {
+		uint64_t value = std::max<int64_t>(duration.count(), 0);
+		_counts[LatencySnapshot::bucket(value)].fetch_add(1, std::memory_order_relaxed);
+		_sum.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	void addTo(LatencySnapshot& snapshot) const {
+		for (int i = 0; i < LatencySnapshot::Buckets; i++) {
+			uint64_t count = _counts[i].load(std::memory_order_relaxed);
+			snapshot._counts[i] += count;
+			snapshot._count += count;
+		}
+		snapshot._sum += _sum.load(std::memory_order_relaxed);
+	}
+};
+
+// Statistics of a server, gathered from all its threads
+struct TcpServerMetrics {
+	int64_t sessions = 0;
+	int64_t accepted = 0;
+	int64_t refused = 0;
+	int64_t closed = 0;
+	int64_t bytesReceived = 0;
+	int64_t bytesSent = 0;
+	int64_t rejected = 0;
+	int64_t tooLong = 0;
+	int64_t timedOut = 0;
+	int64_t grownBuffers = 0;
+	LatencySnapshot latency; // Its count is the number of requests
+
+	TcpServerMetrics& operator+=(const TcpServerCounters& counters) {
+		accepted += counters.accepted.get();
+		refused += counters.refused.get();
+		closed += counters.closed.get();
+		bytesReceived += counters.bytesReceived.get();
+		bytesSent += counters.bytesSent.get();
+		rejected += counters.rejected.get();
+		tooLong += counters.tooLong.get();
+		timedOut += counters.timedOut.get();
+		grownBuffers += counters.grownBuffers.get();
+		return *this;
+	}
+
+	TcpServerMetrics& operator+=(const TcpServerMetrics& other) {
+		sessions += other.sessions;
+		accepted += other.accepted;
+		refused += other.refused;
+		closed += other.closed;
+		bytesReceived += other.bytesReceived;
+		bytesSent += other.bytesSent;
+		rejected += other.rejected;
+		tooLong += other.tooLong;
+		timedOut += other.timedOut;
+		grownBuffers += other.grownBuffers;
+		latency += other.latency;
+		return *this;
+	}
+};
+
+struct IPoolTask {
+	// Interface for work that can be run by ThreadPool
+	virtual void run() = 0;
+};
+
+// Threads that run tasks submitted by other threads. Each thread has its own queue, tasks are distributed between them
+// in turns, a thread without tasks steals the oldest tasks from other threads' queues, so one long task doesn't delay
+// tasks queued after it. Tasks submitted before destruction are finished.
+class ThreadPool {
+	struct Queue {
+		std::mutex lock;
+		std::deque<IPoolTask*> tasks;
+	};
+	std::vector<std::unique_ptr<Queue>> _queues;
+	std::counting_semaphore<> _available = std::counting_semaphore<>(0); // One for each queued task, so no wakeup is lost
+	std::atomic<int> _nextQueue = 0;
+	std::atomic<bool> _stopping = false;
+	std::vector<std::jthread> _threads;
+
+	// Takes the oldest task from the thread's own queue, or from the next queue that has some
+	IPoolTask* take(int own) {
+		for (int i = 0; i < std::ssize(_queues); i++) {
+			Queue& queue = *_queues[(own + i) % _queues.size()];
+			std::lock_guard lock(queue.lock);
+			if (queue.tasks.empty())
+				continue;
+			IPoolTask* task = queue.tasks.front();
+			queue.tasks.pop_front();
+			return task;
+		}
+		return nullptr;
+	}
+
+	void work(int own) {
+		while (true) {
+			_available.acquire();
+			IPoolTask* task = nullptr;
+			// Another thread may have taken a task from this thread's queue while a task queued elsewhere wasn't taken yet
+			while (!task) {
+				task = take(own);
+				if (!task && _stopping.load(std::memory_order_acquire))
+					return;
 			}
+			task->run();
 		}
+	}
 
-		if (!_longLeftovers.empty()) [[unlikely]] {
-			// Long message, make space at the end of the vector
-			_keptEnd = _longLeftovers.size();
-			_longLeftovers.resize(_keptEnd + ResponseBufferSize);
-			_responseBuffer = std::span<char>(_longLeftovers.data() + _keptEnd, _longLeftovers.size() - _keptEnd);
-		} else {
-			if (_keptStart == 0 && _keptEnd == ResponseBufferSize) [[unlikely]] {
-				// No more space in the buffer, move it to the vector
-				_longLeftovers.resize(2 * ResponseBufferSize);
-				memcpy(_longLeftovers.data(), _responseArray.data(), _responseArray.size());
-				_responseBuffer = std::span<char>(_longLeftovers.data() + _keptEnd, _longLeftovers.size() - _keptEnd);
-			} else {
-				// Normal buffer usage
-				if (_keptStart == _keptEnd) {
-					// We can start from the beginning
-					_keptStart = 0;
-					_keptEnd = 0;
-					_responseBuffer = std::span<char>(_responseArray.data(), ResponseMaxSize);
-				} else if (_keptStart > ResponseBufferSize - _keptEnd) {
-					// More space at the start
-					int copySize = _keptEnd - _keptStart;
-					memmove(_responseArray.data(), _responseArray.data() + _keptStart, copySize);
-					int bufferSize = std::min(_keptStart, ResponseMaxSize);
-					_responseBuffer = std::span<char>(_responseArray.data() + copySize, bufferSize);
-					_keptStart = 0;
-					_keptEnd = copySize;
-				} else {
-					// More space at the end
-					int bufferSize = std::min(ResponseBufferSize - _keptEnd, ResponseMaxSize);
-					_responseBuffer = std::span<char>(_responseArray.data() + _keptEnd, bufferSize);
-				}
+public:
+	ThreadPool(int threads = std::thread::hardware_concurrency()) {
+		threads = std::max(threads, 1);
+		for (int i = 0; i < threads; i++) {
+			_queues.push_back(std::make_unique<Queue>());
+		}
+		for (int i = 0; i < threads; i++) {
+			_threads.emplace_back([this, i] {
+				work(i);
+			});
+		}
+	}
+
+	~ThreadPool() {
+		_stopping.store(true, std::memory_order_release);
+		_available.release(_threads.size());
+	}
+
+	// The task must remain valid until it's run, it can be submitted from any thread
+	void submit(IPoolTask& task) {
+		Queue& queue = *_queues[_nextQueue.fetch_add(1, std::memory_order_relaxed) % _queues.size()];
+		{
+			std::lock_guard lock(queue.lock);
+			queue.tasks.push_back(&task);
+		}
+		_available.release();
+	}
+
+	int threadCount() const {
+		return _threads.size();
+	}
+};
+
+namespace Detail {
+// Lock-free queue of objects passed from any threads to one thread, linked through a member pointer of the objects
+template <typename T, T* T::*Next>
+class MpscQueue {
+	std::atomic<T*> _head = nullptr;
+
+public:
+	// Returns true if the queue was empty, so that the consumer can be woken only once per batch
+	bool push(T* item) {
+		T* head = _head.load(std::memory_order_relaxed);
+		do {
+			item->*Next = head;
+		} while (!_head.compare_exchange_weak(head, item, std::memory_order_release, std::memory_order_relaxed));
+		return head == nullptr;
+	}
+
+	// Takes all the items and handles them in the order they were pushed, they can be pushed again from the handler
+	template <typename Handler>
+	void consume(const Handler& handler) {
+		T* taken = _head.exchange(nullptr, std::memory_order_acquire);
+		T* ordered = nullptr;
+		while (taken) {
+			T* next = taken->*Next;
+			taken->*Next = ordered;
+			ordered = taken;
+			taken = next;
+		}
+		while (ordered) {
+			T* next = ordered->*Next;
+			handler(ordered);
+			ordered = next;
+		}
+	}
+};
+
+// Hierarchical timer wheel, arming or cancelling a timer only links or unlinks it from a list and the expiration
+// of timers is checked only once per tick. Each level has 64 slots, each slot of a higher level spans all slots
+// of the level below, their timers are moved to the lower level when it gets to them. Not thread-safe.
+class TimerWheel {
+	constexpr static int SlotBits = 6;
+	constexpr static int Slots = 1 << SlotBits;
+	constexpr static int Levels = 4; // Longest time is 2^24 ticks, longer ones are shortened
+
+public:
+	constexpr static auto DefaultTick = std::chrono::milliseconds(50);
+
+	class Timer {
+		Timer* _next = nullptr;
+		Timer** _link = nullptr; // Whatever points to this timer, null if it's not armed
+		int64_t _expiry = 0; // In ticks
+		friend class TimerWheel;
+
+	public:
+		virtual void expired() = 0;
+		virtual ~Timer() = default;
+
+		bool armed() const {
+			return _link;
+		}
+	};
+
+private:
+	std::array<std::array<Timer*, Slots>, Levels> _slots = {};
+	std::chrono::steady_clock::duration _tick;
+	std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+	int64_t _now = 0; // Last tick whose timers have expired
+	int64_t _latest = 0; // Last known tick, ahead of the previous one while catching up, timers are armed relative to it
+	int _armed = 0;
+
+	int64_t ticksAt(std::chrono::steady_clock::time_point time) const {
+		return (time - _start) / _tick;
+	}
+
+	void link(Timer& timer) {
+		constexpr int64_t longest = (int64_t(1) << (SlotBits * Levels)) - 1;
+		timer._expiry = std::min(timer._expiry, _now + longest);
+		int64_t remaining = std::max<int64_t>(timer._expiry - _now, 0);
+		int level = 0;
+		while (remaining >= int64_t(1) << (SlotBits * (level + 1)))
+			level++;
+		Timer*& head = _slots[level][(timer._expiry >> (SlotBits * level)) & (Slots - 1)];
+		timer._next = head;
+		if (head)
+			head->_link = &timer._next;
+		head = &timer;
+		timer._link = &head;
+	}
+
+	void unlink(Timer& timer) {
+		*timer._link = timer._next;
+		if (timer._next)
+			timer._next->_link = timer._link;
+		timer._next = nullptr;
+		timer._link = nullptr;
+	}
+
+	void step() {
+		_now++;
+		// When lower levels wrap around, a slot of each level above is distributed to the levels below, highest first
+		int wrapped = 0;
+		while (wrapped + 1 < Levels && (_now & ((int64_t(1) << (SlotBits * (wrapped + 1))) - 1)) == 0)
+			wrapped++;
+		for (int level = wrapped; level > 0; level--) {
+			Timer*& head = _slots[level][(_now >> (SlotBits * level)) & (Slots - 1)];
+			while (head) {
+				Timer* moved = head;
+				unlink(*moved);
+				link(*moved);
 			}
 		}
 
-		return true;
+		Timer*& head = _slots[0][_now & (Slots - 1)];
+		while (head) {
+			Timer* expiring = head;
+			unlink(*expiring);
+			expiring->expired(); // May arm or cancel any timers, including this one
+			_armed--; // Only now, so that arming a timer from expired() doesn't seem to be arming the first one
+		}
 	}
 
-	std::span<char> space() {
-		return _responseBuffer;
+public:
+	TimerWheel(std::chrono::steady_clock::duration tick = DefaultTick) : _tick(tick) {}
+
+	TimerWheel(const TimerWheel&) = delete;
+	TimerWheel& operator=(const TimerWheel&) = delete;
+
+	// Arms the timer again if it's armed, it expires no sooner than after the given time and no later than a tick after that
+	void arm(Timer& timer, std::chrono::steady_clock::duration after) {
+		if (timer.armed())
+			unlink(timer);
+		else if (_armed++ == 0)
+			_now = _latest = ticksAt(std::chrono::steady_clock::now()); // Nothing was armed, so the ticks may have been skipped
+		timer._expiry = _latest + 1 + (after + _tick - std::chrono::steady_clock::duration(1)) / _tick;
+		link(timer);
+	}
+
+	void cancel(Timer& timer) {
+		if (!timer.armed())
+			return;
+		unlink(timer);
+		_armed--;
+	}
+
+	bool empty() const {
+		return _armed == 0;
+	}
+
+	// When advance() should be called next
+	std::chrono::steady_clock::time_point nextTick() const {
+		return _start + (_now + 1) * _tick;
+	}
+
+	// Lets the timers that have expired by the given time expire
+	void advance(std::chrono::steady_clock::time_point now) {
+		_latest = std::max(_latest, ticksAt(now));
+		while (_now < _latest && _armed > 0)
+			step();
+		_now = _latest;
 	}
 };
 
+// Timer of a session that picks the time limit for what the session is waiting for
+class SessionDeadline : public TimerWheel::Timer {
+	enum class Phase : uint8_t {
+		IDLE,
+		HEADER,
+		BODY,
+	} _phase = Phase::IDLE;
+
+public:
+	// Should be called after processing input or sending output, the idle time limit is counted from the last activity,
+	// the header and body limits from the moment the header or body started arriving
+	template <typename ResponderSession>
+	void update(TimerWheel& timers, const TcpServerTimeouts& timeouts, const TcpServerBuffer& buffer,
+			const ResponderSession& responder) {
+		Phase phase = Phase::IDLE;
+		if (buffer.incomplete()) {
+			phase = Phase::HEADER;
+			if constexpr (requires { responder.readingBody(); }) {
+				if (responder.readingBody())
+					phase = Phase::BODY;
+			}
+		}
+		if (phase == _phase && phase != Phase::IDLE)
+			return;
+		_phase = phase;
+		std::chrono::milliseconds limit = (phase == Phase::IDLE) ? timeouts.idle
+				: (phase == Phase::HEADER) ? timeouts.header : timeouts.body;
+		if (limit.count() > 0)
+			timers.arm(*this, limit);
+		else
+			timers.cancel(*this);
+	}
+
+	// Should be called when processing of requests starts elsewhere, time spent on that doesn't count as idle
+	void busy(TimerWheel& timers) {
+		if (_phase == Phase::IDLE)
+			timers.cancel(*this);
+	}
+
+	void stop(TimerWheel& timers) {
+		timers.cancel(*this);
+		_phase = Phase::IDLE;
+	}
+};
+
+// All sessions are allocated when the server is created and reused for further connections, so accepting and closing
+// connections doesn't allocate, also limits the number of connections
+template <typename Session>
+class SessionSlab {
+	std::unique_ptr<Session[]> _sessions;
+	std::unique_ptr<Session*[]> _free;
+	int _capacity = 0;
+	std::atomic<int> _freeCount = 0; // Only changed with a lock or from one thread, but can be read from anywhere
+
+public:
+	SessionSlab(int capacity)
+			: _sessions(std::make_unique<Session[]>(capacity)), _free(std::make_unique<Session*[]>(capacity)),
+			_capacity(capacity), _freeCount(capacity) {
+		for (int i = 0; i < capacity; i++) {
+			_free[i] = &_sessions[capacity - i - 1];
+		}
+	}
+
+	// Returns nullptr if all sessions are in use
+	Session* acquire() {
+		int freeCount = _freeCount.load(std::memory_order_relaxed);
+		if (freeCount == 0) [[unlikely]]
+			return nullptr;
+		_freeCount.store(freeCount - 1, std::memory_order_relaxed);
+		return _free[freeCount - 1];
+	}
+
+	void release(Session* session) {
+		int freeCount = _freeCount.load(std::memory_order_relaxed);
+		_free[freeCount] = session;
+		_freeCount.store(freeCount + 1, std::memory_order_relaxed);
+	}
+
+	int used() const {
+		return _capacity - _freeCount.load(std::memory_order_relaxed);
+	}
+
+	int capacity() const {
+		return _capacity;
+	}
+
+	Session& operator[](int index) {
+		return _sessions[index];
+	}
+};
+
+struct ReusePortOption {
+	int value = 1;
+	template <typename Protocol> int level(const Protocol&) const { return SOL_SOCKET; }
+	template <typename Protocol> int name(const Protocol&) const { return SO_REUSEPORT; }
+	template <typename Protocol> const void* data(const Protocol&) const { return &value; }
+	template <typename Protocol> size_t size(const Protocol&) const { return sizeof(value); }
+};
+
+// Output written while the responder is still running is sent once this much of it is queued, so that the start of a long
+// (chunked) response doesn't wait until its end is produced, while short pipelined responses are still sent together
+constexpr int64_t EarlySendSize = 16384;
+} // namespace Detail
+
+struct ReusePort {
+	// Tag for letting several servers in the process listen on the same port, the kernel distributes connections between them
+};
+
+// What BackgroundTcpServer and ShardedTcpServer need from a server, any networking backend providing it can be plugged in
+template <typename Server>
+concept TcpServerBackend = requires(Server& server, int64_t size) {
+	server.run();
+	server.stopRunning();
+	server.runARound();
+	{ server.threadCount() } -> std::convertible_to<int>;
+	{ server.connectionCount() } -> std::convertible_to<int>;
+	server.setOutputWatermarks(size, size);
+	server.setMaxMessageSize(size);
+	server.setTimeouts(TcpServerTimeouts{});
+	server.setExecutor(static_cast<ThreadPool*>(nullptr));
+	{ server.bytesQueued() } -> std::convertible_to<int64_t>;
+	{ server.latency() } -> std::convertible_to<LatencySnapshot>;
+	server.resetLatency();
+	{ server.metrics() } -> std::convertible_to<TcpServerMetrics>;
+	{ server.averageResponseTime() } -> std::convertible_to<std::chrono::nanoseconds>;
+};
+
 template <typename Responder>
 class TcpServer {
+	struct Worker;
+
 	Responder& _responder;
-	Net::io_context _context;
 	Net::ip::tcp::endpoint _endpoint;
-	Net::ip::tcp::acceptor _acceptor = {_context, _endpoint};
-	std::chrono::nanoseconds _totalResponseTime = std::chrono::nanoseconds(0);
-	int64_t _totalResponses = 0;
+	std::string _unixSocketPath; // Empty if listening on a TCP port
+	LatencyHistogram _offloadedLatency; // Recorded by the executor's threads
+	LatencySnapshot _latencyBaseline; // Subtracted from the recorded latencies, for resetting them
+	std::mutex _latencyLock;
+	std::atomic<int64_t> _bytesQueued = 0;
+	int64_t _outputHighWatermark = 65536; // A session stops reading requests if this many bytes of its responses are not sent
+	int64_t _outputLowWatermark = 16384; // A session that stopped reading requests resumes when its unsent responses shrink to this
+	int _maxMessageSize = TcpServerBuffer::DefaultMaxMessageSize;
+	TcpServerTimeouts _timeouts;
+	ThreadPool* _executor = nullptr;
+	std::atomic<int> _offloadedTasks = 0;
 
-	struct Session : ITcpServerSession {
-		Net::ip::tcp::socket _socket;
-		typename Responder::Session _responder;
+	struct Session : ITcpServerSession, Detail::SessionDeadline, IPoolTask {
+		std::optional<Net::ip::tcp::socket> _socket; // Empty while the session is not in use
+		std::optional<typename Responder::Session> _responder;
 		TcpServerBuffer _buffer;
-		Net::const_buffer _space = {};
-		TcpServer& _parent = nullptr;
-		int _index = {};
+		TcpServer* _parent = nullptr;
+		Worker* _worker = nullptr;
+		ThreadPool* _executor = nullptr; // Processes the requests if set, otherwise they are processed by the worker thread
 
-		Session(Net::ip::tcp::socket&& socket, Responder& responder, TcpServer& parent, int index)
-				: _socket(std::move(socket)), _responder(responder.getSession()), _parent(parent), _index(index) {
+		// Responses are queued and sent asynchronously, so that a client that doesn't read them can't block the thread
+		std::vector<char> _outputQueue; // Responses written while another batch is being sent
+		std::vector<char> _outputSending; // The batch being sent
+		int _sendingPosition = 0;
+		Net::const_buffer _sendSpace = {};
+		bool _reading = false;
+		bool _sending = false;
+		bool _readingPaused = false; // Too much output is queued
+		bool _closing = false;
+
+		// While the executor processes the requests, the session doesn't read, so the responses stay in order
+		bool _offloaded = false;
+		int64_t _offloadedProcessed = 0;
+		std::vector<char> _offloadedOutput; // Responses written by the executor
+		Session* _nextFinished = nullptr; // For returning to the worker thread
+		std::chrono::steady_clock::time_point _messageStart; // When processing of the current message started
+
+		void open(Net::ip::tcp::socket&& socket, TcpServer& parent, Worker& worker) {
+			_parent = &parent;
+			_worker = &worker;
+			_executor = parent._executor;
+			_socket.emplace(std::move(socket));
+			_responder.emplace(parent._responder.getSession());
+			_buffer.reset(&worker.receiveBuffers, parent._maxMessageSize, &worker.counters);
+			worker.counters.accepted.add(1);
+			int handle = _socket->native_handle();
+			::fcntl(handle, F_SETFL, ::fcntl(handle, F_GETFL) | O_NONBLOCK);
+			// Responses are already batched, Nagle's algorithm would only delay them (Unix domain sockets don't have it)
+			std::error_code ignored;
+			_socket->set_option(Net::ip::tcp::no_delay(true), ignored);
+			updateDeadline();
 			readSome();
 		}
 
-		void readSome() {
-			std::span<char> space = _buffer.space();
-			_space = Net::buffer(space.data(), space.size());
-			_socket.async_receive(_space, [this] (std::error_code error, int length = 0) {
-				auto startTime = std::chrono::steady_clock::now();
+		// Makes the session ready for another connection, keeping the allocated memory unless there's too much of it
+		void recycle() {
+			_parent->_bytesQueued.fetch_sub(queuedBytes() + _offloadedOutput.size(), std::memory_order_relaxed);
+			_worker->counters.closed.add(1);
+			stop(_worker->timers);
+			_socket.reset();
+			_responder.reset();
+			_buffer.reset(nullptr);
+			for (std::vector<char>* output : {&_outputQueue, &_outputSending, &_offloadedOutput}) {
+				output->clear();
+				if (int64_t(output->capacity()) > _parent->_outputHighWatermark) [[unlikely]]
+					*output = {};
+			}
+			_sendingPosition = 0;
+			_reading = false;
+			_sending = false;
+			_readingPaused = false;
+			_closing = false;
+		}
 
+		void readSome() {
+			_reading = true;
+			// Memory for the data is taken from the pool only once there is something to receive
+			_socket->async_wait(Net::socket_base::wait_read, [this] (std::error_code error) {
+				_reading = false;
+				if (_closing) {
+					finishClosing();
+					return;
+				}
+				int length = 0;
+				if (!error) [[likely]] {
+					BOMBA_TRACE_SCOPE("recv");
+					std::span<char> space = _buffer.space();
+					length = _socket->receive(Net::buffer(space.data(), space.size()), error);
+					_worker->counters.bytesReceived.add(length);
+				}
+				if (error == std::errc::operation_would_block || error == std::errc::resource_unavailable_try_again) [[unlikely]] {
+					_buffer.unused();
+					readSome();
+					return;
+				}
+				if (_executor) [[unlikely]] {
+					if (_buffer.store(error, length))
+						offload();
+					else
+						proceed(false, bool(error));
+					return;
+				}
+				_messageStart = std::chrono::steady_clock::now();
 				bool expectingMore = _buffer.receive(*this, error, length);
+				flush();
+				proceed(expectingMore, bool(error));
+			});
+		}
 
-				if (expectingMore) {
+		// Continues reading after the received data was processed, or closes the connection
+		void proceed(bool expectingMore, bool broken) {
+			if (expectingMore) {
+				updateDeadline();
+				if (queuedBytes() < _parent->_outputHighWatermark) [[likely]]
 					readSome();
+				else
+					_readingPaused = true;
+				return;
+			}
+			// Responses to the last requests are still sent if the connection wasn't broken
+			if (broken || !_sending)
+				cancel();
+			else
+				_closing = true;
+		}
+
+		void offload() {
+			_offloaded = true;
+			busy(_worker->timers);
+			_parent->_offloadedTasks.fetch_add(1, std::memory_order_relaxed);
+			_executor->submit(*this);
+		}
+
+		// Runs on a thread of the executor, the worker thread doesn't touch the buffer or the responder meanwhile
+		void run() override {
+			_messageStart = std::chrono::steady_clock::now();
+			_offloadedProcessed = TcpServerBuffer::processMessages(*this, _buffer.unprocessed());
+			TcpServer* parent = _parent;
+			Worker* worker = _worker; // Once it's pushed, the session may be closed and reused
+			if (worker->finished.push(this)) {
+				uint64_t increment = 1;
+				[[maybe_unused]] auto written = ::write(worker->waker.native_handle(), &increment, sizeof(increment));
+			}
+			parent->_offloadedTasks.fetch_sub(1, std::memory_order_release);
+		}
+
+		// Back on the worker thread
+		void finishOffloaded() {
+			_offloaded = false;
+			if (_closing) {
+				finishClosing();
+				return;
+			}
+			if (_outputQueue.empty())
+				std::swap(_outputQueue, _offloadedOutput);
+			else
+				_outputQueue.insert(_outputQueue.end(), _offloadedOutput.begin(), _offloadedOutput.end());
+			_offloadedOutput.clear();
+			bool expectingMore = _buffer.consumeProcessed(_offloadedProcessed);
+			flush();
+			proceed(expectingMore, false);
+		}
+
+		int64_t queuedBytes() const {
+			return _outputQueue.size() + _outputSending.size() - _sendingPosition;
+		}
+
+		// All responses produced while processing one read are gathered in the queue and written by one system call
+		void flush() {
+			if (_sending || _outputQueue.empty())
+				return;
+			std::swap(_outputQueue, _outputSending);
+			_outputQueue.clear();
+			_sendingPosition = 0;
+
+			// The socket is usually writable, waiting until the reactor confirms it would cost another system call
+			std::error_code error;
+			BOMBA_TRACE_BEGIN("send");
+			int sent = _socket->send(Net::buffer(_outputSending.data(), _outputSending.size()),
+					Net::socket_base::message_flags(MSG_NOSIGNAL), error);
+			BOMBA_TRACE_END("send");
+			if (!error) [[likely]] {
+				_parent->_bytesQueued.fetch_sub(sent, std::memory_order_relaxed);
+				_worker->counters.bytesSent.add(sent);
+				_sendingPosition = sent;
+				if (_sendingPosition == std::ssize(_outputSending)) [[likely]] {
+					_outputSending.clear();
+					_sendingPosition = 0;
+					return;
 				}
-				auto endTime = std::chrono::steady_clock::now();
-				_parent._totalResponseTime += std::chrono::duration_cast<std::chrono::nanoseconds>(endTime - startTime);
+			}
+			sendSome(); // Sends the rest when possible or handles the error
+		}
 
-				if (!expectingMore) {
+		void sendSome() {
+			_sendSpace = Net::buffer(_outputSending.data() + _sendingPosition, _outputSending.size() - _sendingPosition);
+			_sending = true;
+			// Without MSG_NOSIGNAL, sending to a client that has disconnected would kill the process with SIGPIPE
+			_socket->async_send(_sendSpace, Net::socket_base::message_flags(MSG_NOSIGNAL), [this] (std::error_code error, int length = 0) {
+				_sending = false;
+				if (error == std::errc::operation_would_block || error == std::errc::resource_unavailable_try_again) [[unlikely]] {
+					sendSome();
+					return;
+				}
+				if (error) {
+					_parent->_bytesQueued.fetch_sub(queuedBytes(), std::memory_order_relaxed);
+					_outputQueue.clear();
+					_outputSending.clear();
+					_sendingPosition = 0;
 					cancel();
 					return;
 				}
-
+				_parent->_bytesQueued.fetch_sub(length, std::memory_order_relaxed);
+				_worker->counters.bytesSent.add(length);
+				_sendingPosition += length;
+				if (_sendingPosition < std::ssize(_outputSending)) {
+					sendSome();
+					return;
+				}
+				_outputSending.clear();
+				_sendingPosition = 0;
+				flush();
+				if (_closing && !_sending) {
+					cancel();
+					return;
+				}
+				if (_offloaded) [[unlikely]]
+					return; // Continues when the executor finishes
+				updateDeadline();
+				if (_readingPaused && queuedBytes() <= _parent->_outputLowWatermark) {
+					_readingPaused = false;
+					readSome();
+				}
 			});
 		}
 
-		void cancel() { // MUST RETURN AFTER CALLING cancel(), IT DESTROYS this
-			_socket.close();
-			_parent.destroySession(_index);
+		void updateDeadline() {
+			update(_worker->timers, _parent->_timeouts, _buffer, *_responder);
+			_parent->keepTicking(*_worker);
+		}
+
+		void expired() override {
+			_worker->counters.timedOut.add(1);
+			cancel(); // Also if it's already closing, but can't send the last responses
+		}
+
+		void cancel() { // MUST RETURN AFTER CALLING cancel(), IT MAY DESTROY this
+			_closing = true;
+			_socket->close(); // Pending operations will be called with an error
+			finishClosing();
+		}
+
+		void finishClosing() {
+			if (!_reading && !_sending && !_offloaded)
+				_parent->destroySession(this);
 		}
 
 		std::pair<ServerReaction, int> feedToResponder(std::span<char> data) override {
-			return _responder.respond(data, [this] (std::span<const char> output) {
-				_socket.send(Net::buffer(output.data(), output.size()));
+			return _responder->respond(data, [this] (std::span<const char> output) {
+				std::vector<char>& target = _offloaded ? _offloadedOutput : _outputQueue;
+				target.insert(target.end(), output.begin(), output.end());
+				_parent->_bytesQueued.fetch_add(output.size(), std::memory_order_relaxed);
+				// Only the worker thread may send, output written by the executor waits until it finishes
+				if (!_offloaded && std::ssize(_outputQueue) >= Detail::EarlySendSize) [[unlikely]]
+					flush();
 			});
 		}
 
+		// Each message's time is measured separately, a single clock reading ends one message's time and starts the next one's
 		void notifyMessageWasParsed() override {
-			_parent._totalResponses++;
+			auto now = std::chrono::steady_clock::now();
+			if (_offloaded) [[unlikely]]
+				_parent->_offloadedLatency.recordConcurrently(now - _messageStart);
+			else
+				_worker->latency.record(now - _messageStart);
+			_messageStart = now;
 		}
+	};
 
-		~Session() {
-		}
+	// Each worker thread has its own context and its own handle to the listening socket, so a session stays
+	// on the thread that accepted it and its handlers never run concurrently
+	struct Worker {
+		Net::io_context context;
+		Net::ip::tcp::acceptor acceptor = Net::ip::tcp::acceptor(context);
+		ReceiveBufferPool receiveBuffers;
+		Detail::TimerWheel timers;
+		Net::steady_timer ticker = Net::steady_timer(context); // Runs only while some timer is armed
+		bool ticking = false;
+		Detail::MpscQueue<Session, &Session::_nextFinished> finished; // Sessions whose requests the executor processed
+		Net::ip::tcp::socket waker = makeWaker(context); // Signalled when some sessions are finished
+		LatencyHistogram latency;
+		TcpServerCounters counters;
 	};
 
-	std::vector<std::unique_ptr<Session>> _sessions;
+	Worker _mainWorker;
+	std::vector<std::unique_ptr<Worker>> _extraWorkers;
+	Detail::SessionSlab<Session> _sessions;
 	std::mutex _sessionsLock;
 
-	void startSession() {
-		_acceptor.async_accept(_context, [&] (std::error_code error, Net::ip::tcp::socket socket) {
+	void startSession(Worker& worker) {
+		worker.acceptor.async_accept(worker.context, [this, &worker] (std::error_code error, Net::ip::tcp::socket socket) {
 			if (error) {
-//				std::cout << "Error: " << error.message() << std::endl;
+				if (error == std::errc::operation_would_block || error == std::errc::resource_unavailable_try_again) {
+					// Another thread accepted the connection first
+					startSession(worker);
+				}
 				return;
 			}
+			BOMBA_TRACE_BEGIN("accept");
+			Session* session = nullptr;
 			{
 				std::lock_guard lock(_sessionsLock);
-				int index = _sessions.size();
-				_sessions.emplace_back(std::make_unique<Session>(std::move(socket), _responder, *this, index));
+				session = _sessions.acquire();
 			}
-			startSession();
+			if (session) [[likely]]
+				session->open(std::move(socket), *this, worker);
+			else // The connection limit was reached, the socket is closed when it goes out of scope
+				worker.counters.refused.add(1);
+			BOMBA_TRACE_END("accept");
+			startSession(worker);
 		});
 	}
 
-	void destroySession(int index) {
+	// An eventfd, only waited for, the socket class is used because there's no better way to wait for it
+	static Net::ip::tcp::socket makeWaker(Net::io_context& context) {
+		Net::ip::tcp::socket waker(context);
+		waker.assign(Net::ip::tcp::v4(), ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+		return waker;
+	}
+
+	void collectFinished(Worker& worker) {
+		worker.waker.async_wait(Net::socket_base::wait_read, [this, &worker] (std::error_code error) {
+			if (error)
+				return;
+			uint64_t count = 0;
+			[[maybe_unused]] auto read = ::read(worker.waker.native_handle(), &count, sizeof(count));
+			worker.finished.consume([] (Session* session) {
+				session->finishOffloaded();
+			});
+			collectFinished(worker);
+		});
+	}
+
+	// Timers are checked periodically by one timer per thread, which isn't running if there's nothing to check
+	void keepTicking(Worker& worker) {
+		if (worker.ticking || worker.timers.empty())
+			return;
+		worker.ticking = true;
+		worker.ticker.expires_at(worker.timers.nextTick());
+		worker.ticker.async_wait([this, &worker] (std::error_code error) {
+			worker.ticking = false;
+			if (error)
+				return;
+			worker.timers.advance(std::chrono::steady_clock::now());
+			keepTicking(worker);
+		});
+	}
+
+	void destroySession(Session* session) {
+		session->recycle();
 		std::lock_guard lock(_sessionsLock);
-		if (index < std::ssize(_sessions) - 1) [[likely]] {
-			_sessions.back()->_index = index;
-			std::swap(_sessions[index], _sessions.back());
+		_sessions.release(session);
+	}
+
+	static Net::ip::tcp::acceptor makeAcceptor(Net::io_context& context, const Net::ip::tcp::endpoint& endpoint, bool reusePort) {
+		if (!reusePort) [[likely]]
+			return Net::ip::tcp::acceptor(context, endpoint);
+		Net::ip::tcp::acceptor acceptor(context, endpoint.protocol());
+		acceptor.set_option(Net::socket_base::reuse_address(true));
+		acceptor.set_option(Detail::ReusePortOption{});
+		acceptor.bind(endpoint);
+		acceptor.listen();
+		return acceptor;
+	}
+
+	void startWorkers(int threads) {
+		if (threads > 1) {
+			// The listening socket is shared, it must not block threads that lost the race for a connection
+			int listener = _mainWorker.acceptor.native_handle();
+			::fcntl(listener, F_SETFL, ::fcntl(listener, F_GETFL) | O_NONBLOCK);
+			for (int i = 1; i < threads; i++) {
+				auto& worker = *_extraWorkers.emplace_back(std::make_unique<Worker>());
+				worker.acceptor.assign(Net::ip::tcp::v4(), ::dup(listener));
+				startSession(worker);
+				collectFinished(worker);
+			}
 		}
-		_sessions.pop_back();
+		startSession(_mainWorker);
+		collectFinished(_mainWorker);
 	}
 
+	template <typename, template <typename> typename>
+	friend class ShardedTcpServer;
+
 public:
-	TcpServer(Responder& responder, int port, int threads)
-			: _context(threads), _responder(responder), _endpoint(Net::ip::tcp::v4(), port) {
-		startSession();
+	constexpr static int DefaultMaxConnections = 1024;
+
+	// Runs on the given number of threads, each of them accepting connections and handling the sessions it accepted.
+	// Memory for the maximum number of connections is allocated in advance, further connections are closed immediately.
+	TcpServer(Responder& responder, int port, int threads = 1, int maxConnections = DefaultMaxConnections)
+			: _responder(responder), _endpoint(Net::ip::tcp::v4(), port), _sessions(maxConnections) {
+		_mainWorker.acceptor = makeAcceptor(_mainWorker.context, _endpoint, false);
+		startWorkers(threads);
+	}
+	// Listens on a Unix domain socket, which avoids the TCP stack for clients on the same host, the socket's file is removed
+	// when the server is destroyed
+	TcpServer(Responder& responder, UnixSocketPath path, int threads = 1, int maxConnections = DefaultMaxConnections)
+			: _responder(responder), _unixSocketPath(path.path), _sessions(maxConnections) {
+		// The acceptor only uses the handle, so it doesn't matter it's not TCP
+		_mainWorker.acceptor.assign(Net::ip::tcp::v4(), Detail::listenOnUnixSocket(_unixSocketPath));
+		startWorkers(threads);
+	}
+	// Binds its own listening socket with SO_REUSEPORT, other servers can listen on the same port
+	TcpServer(Responder& responder, int port, ReusePort, int maxConnections = DefaultMaxConnections)
+			: _responder(responder), _endpoint(Net::ip::tcp::v4(), port), _sessions(maxConnections) {
+		_mainWorker.acceptor = makeAcceptor(_mainWorker.context, _endpoint, true);
+		startSession(_mainWorker);
+		collectFinished(_mainWorker);
 	}
-	TcpServer(Responder& responder, int port)
-			: _responder(responder), _endpoint(Net::ip::tcp::v4(), port) {
-		startSession();
+
+	TcpServer(const TcpServer&) = delete;
+	TcpServer& operator=(const TcpServer&) = delete;
+
+	~TcpServer() {
+		// The executor may still be processing requests of some sessions
+		while (_offloadedTasks.load(std::memory_order_acquire) > 0)
+			std::this_thread::yield();
+		if (!_unixSocketPath.empty())
+			::unlink(_unixSocketPath.c_str());
 	}
 
+	// Runs the first thread in the calling thread, the others in additional threads that are joined before returning
 	void run() {
-		_context.run();
+		std::vector<std::jthread> threads;
+		for (auto& worker : _extraWorkers) {
+			threads.emplace_back([&context = worker->context] {
+				context.run();
+			});
+		}
+		_mainWorker.context.run();
 	}
 
 	void stopRunning() {
-		_context.stop();
+		_mainWorker.context.stop();
+		for (auto& worker : _extraWorkers) {
+			worker->context.stop();
+		}
 	}
 
 	void runARound() {
-		_context.poll();
+		_mainWorker.context.poll();
+		for (auto& worker : _extraWorkers) {
+			worker->context.poll();
+		}
+	}
+
+	int threadCount() const {
+		return 1 + _extraWorkers.size();
+	}
+
+	int connectionCount() const {
+		return _sessions.used();
+	}
+
+	// Sets how much output can be queued in a session before it stops reading requests and when it resumes reading
+	void setOutputWatermarks(int64_t high, int64_t low) {
+		_outputHighWatermark = high;
+		_outputLowWatermark = low;
+	}
+
+	// A client sending a longer message is disconnected, applies to connections accepted later
+	void setMaxMessageSize(int size) {
+		_maxMessageSize = size;
+	}
+
+	// All limits are disabled by default
+	void setTimeouts(const TcpServerTimeouts& timeouts) {
+		_timeouts = timeouts;
+	}
+
+	// Requests are processed by the executor's threads rather than by the thread that received them, so that slow requests
+	// don't delay other sessions, applies to connections accepted later. The executor must outlive the server.
+	void setExecutor(ThreadPool* executor) {
+		_executor = executor;
+	}
+
+	// Total size of responses waiting to be sent in all sessions
+	int64_t bytesQueued() const {
+		return _bytesQueued.load(std::memory_order_relaxed);
+	}
+
+	// Times of processing of messages received since the start or since resetLatency(), merged from all threads
+	LatencySnapshot latency() {
+		LatencySnapshot snapshot;
+		_mainWorker.latency.addTo(snapshot);
+		for (auto& worker : _extraWorkers) {
+			worker->latency.addTo(snapshot);
+		}
+		_offloadedLatency.addTo(snapshot);
+		std::lock_guard lock(_latencyLock);
+		snapshot -= _latencyBaseline;
+		return snapshot;
+	}
+
+	void resetLatency() {
+		LatencySnapshot snapshot = latency();
+		std::lock_guard lock(_latencyLock);
+		_latencyBaseline += snapshot;
+	}
+
+	// Reads the counters of all threads without stopping them
+	TcpServerMetrics metrics() {
+		TcpServerMetrics metrics;
+		metrics.sessions = connectionCount();
+		metrics += _mainWorker.counters;
+		for (auto& worker : _extraWorkers) {
+			metrics += worker->counters;
+		}
+		metrics.latency = latency();
+		return metrics;
 	}
 
 	std::chrono::nanoseconds averageResponseTime() {
-		return _totalResponseTime / _totalResponses;
+		return latency().mean();
 	}
 };
 
-template <typename Responder>
-class BackgroundTcpServer : private TcpServer<Responder> {
+template <typename Responder, template <typename> typename Shard = TcpServer>
+requires TcpServerBackend<Shard<Responder>>
+class ShardedTcpServer {
+	// Every shard is a complete single-threaded server with its own context, listening socket and session table,
+	// all bound to the same port with SO_REUSEPORT, so they share nothing and the kernel balances connections
+	std::vector<std::unique_ptr<Shard<Responder>>> _shards;
+	bool _pinThreads = false;
+
+	void pinCurrentThread(int shard) {
+#ifdef __linux__
+		if (!_pinThreads)
+			return;
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(shard % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#endif
+	}
+
+public:
+	// Creates one shard per core by default, pinning the threads to cores is optional
+	ShardedTcpServer(Responder& responder, int port, int shards = std::thread::hardware_concurrency(), bool pinThreads = false,
+			int maxConnectionsPerShard = Shard<Responder>::DefaultMaxConnections)
+			: _pinThreads(pinThreads) {
+		for (int i = 0; i < std::max(shards, 1); i++) {
+			_shards.emplace_back(std::make_unique<Shard<Responder>>(responder, port, ReusePort{}, maxConnectionsPerShard));
+		}
+	}
+
+	// Runs the first shard in the calling thread, the others in additional threads that are joined before returning
+	void run() {
+		std::vector<std::jthread> threads;
+		for (int i = 1; i < std::ssize(_shards); i++) {
+			threads.emplace_back([this, i] {
+				pinCurrentThread(i);
+				_shards[i]->run();
+			});
+		}
+		pinCurrentThread(0);
+		_shards[0]->run();
+	}
+
+	void stopRunning() {
+		for (auto& shard : _shards) {
+			shard->stopRunning();
+		}
+	}
+
+	void runARound() {
+		for (auto& shard : _shards) {
+			shard->runARound();
+		}
+	}
+
+	int threadCount() const {
+		return _shards.size();
+	}
+
+	int connectionCount() const {
+		int total = 0;
+		for (auto& shard : _shards) {
+			total += shard->connectionCount();
+		}
+		return total;
+	}
+
+	void setOutputWatermarks(int64_t high, int64_t low) {
+		for (auto& shard : _shards) {
+			shard->setOutputWatermarks(high, low);
+		}
+	}
+
+	void setMaxMessageSize(int size) {
+		for (auto& shard : _shards) {
+			shard->setMaxMessageSize(size);
+		}
+	}
+
+	void setTimeouts(const TcpServerTimeouts& timeouts) {
+		for (auto& shard : _shards) {
+			shard->setTimeouts(timeouts);
+		}
+	}
+
+	// All shards can share one executor
+	void setExecutor(ThreadPool* executor) {
+		for (auto& shard : _shards) {
+			shard->setExecutor(executor);
+		}
+	}
+
+	int64_t bytesQueued() const {
+		int64_t total = 0;
+		for (auto& shard : _shards) {
+			total += shard->bytesQueued();
+		}
+		return total;
+	}
+
+	LatencySnapshot latency() {
+		LatencySnapshot snapshot;
+		for (auto& shard : _shards) {
+			snapshot += shard->latency();
+		}
+		return snapshot;
+	}
+
+	void resetLatency() {
+		for (auto& shard : _shards) {
+			shard->resetLatency();
+		}
+	}
+
+	TcpServerMetrics metrics() {
+		TcpServerMetrics metrics;
+		for (auto& shard : _shards) {
+			metrics += shard->metrics();
+		}
+		return metrics;
+	}
+
+	std::chrono::nanoseconds averageResponseTime() {
+		return latency().mean();
+	}
+};
+
+template <typename Responder, template <typename> typename Server = TcpServer>
+requires TcpServerBackend<Server<Responder>>
+class BackgroundTcpServer : private Server<Responder> {
 	std::thread _worker;
 	void startWorker() {
 		_worker = std::thread([this] {
-			TcpServer<Responder>::run();
+			Server<Responder>::run();
 		});
 	}
 public:
-	BackgroundTcpServer(Responder& responder, int port, int threads)
-			: TcpServer<Responder>(responder, port, threads) {
-		startWorker();
-	}
-	BackgroundTcpServer(Responder& responder, int port)
-			: TcpServer<Responder>(responder, port) {
+	template <typename... Args>
+	BackgroundTcpServer(Responder& responder, Args... args)
+			: Server<Responder>(responder, args...) {
 		startWorker();
 	}
 	~BackgroundTcpServer() {
-		TcpServer<Responder>::stopRunning();
+		Server<Responder>::stopRunning();
 		_worker.join();
 	}
 
 	std::chrono::nanoseconds averageResponseTime() {
-		return TcpServer<Responder>::averageResponseTime();
+		return Server<Responder>::averageResponseTime();
 	}
+
+	using Server<Responder>::setOutputWatermarks;
+	using Server<Responder>::setMaxMessageSize;
+	using Server<Responder>::setTimeouts;
+	using Server<Responder>::setExecutor;
+	using Server<Responder>::bytesQueued;
+	using Server<Responder>::connectionCount;
+	using Server<Responder>::latency;
+	using Server<Responder>::resetLatency;
+	using Server<Responder>::metrics;
 };
 
 } // namespace Bomba
@@ -12,9 +12,20 @@
 #include "bomba_json_wsp_description.hpp"
 #include "bomba_dynamic_object.hpp"
 #include "bomba_binary_protocol.hpp"
+#include "bomba_io_uring_server.hpp"
+#include "bomba_metrics.hpp"
+#include "bomba_rpc_statistics.hpp"
+#include "bomba_tracing.hpp"
+#include "bomba_download_server.hpp"
+#include "bomba_traffic_capture.hpp"
+#include "bomba_loopback_client.hpp"
+#include "bomba_shared_memory.hpp"
+#include "bomba_udp.hpp"
+#include "bomba_allocation_counting.hpp"
 #include <string>
 #include <map>
 #include <memory>
+#include <malloc.h>
 
 using namespace Bomba;
 
@@ -339,12 +350,25 @@ struct FakeServer {
 		std::string response;
 		ServerReaction result = session.respond(std::span<char>(request.data(), request.size()),
 						[&] (std::span<const char> output) {
-				response = std::string_view(output.data(), output.size());
+				response += std::string_view(output.data(), output.size());
 		}).first;
 		return {response, result};
 	}
 };
 
+// Plain socket connected to a test server on this host, receiving times out so that a failure doesn't block the test
+int connectRawSocket(int port = 8901) {
+	int socket = ::socket(AF_INET, SOCK_STREAM, 0);
+	timeval limit = {2, 0};
+	setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit));
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	::connect(socket, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+	return socket;
+}
+
 struct ManualBinary {
 	std::string str;
 	template <typename T>
@@ -360,6 +384,18 @@ struct ManualBinary {
 	}
 };
 
+struct BinaryTestFixture {
+	AdvancedRpcClass serverApi;
+	BinaryProtocolServer<> binaryServer = {serverApi};
+	Bomba::BackgroundTcpServer<decltype(binaryServer)> server = {binaryServer, 8901}; // Very unlikely this port will be used for something
+
+	AdvancedRpcClass clientApi;
+	std::string targetAddress = "0.0.0.0";
+	std::string targetPort = "8901";
+	Bomba::SyncNetworkClient client = {targetAddress, targetPort};
+	BinaryProtocolClient<> binaryClient = {clientApi, client};
+};
+
 int main(int argc, char** argv) {
 
 	int errors = 0;
@@ -898,6 +934,49 @@ int main(int argc, char** argv) {
 		doATest(http.written, advancedRpcRequest3);
 	}
 
+	{
+		std::cout << "Testing RPC statistics" << std::endl;
+		AdvancedRpcClass advancedRpc;
+		Bomba::RpcStatistics statistics;
+		DummyWriteStarter writeStarter;
+		auto viewToSpan = [] (std::string_view str) { return std::span<char>(const_cast<char*>(str.data()), str.size()); };
+		Bomba::JsonRpcServerProtocol protocol = advancedRpc;
+		protocol.setCallObserver(&statistics);
+		protocol.post("", "application/json", viewToSpan(advancedRpcRequest1), writeStarter);
+		for (int i = 0; i < 3; i++)
+			protocol.post("", "application/json", viewToSpan(advancedRpcRequest3), writeStarter);
+		std::string wrongSum = R"({"jsonrpc" : "2.0", "id" : 3, "method" : "sum", "params" : {"first" : "two", "second" : 3}})";
+		protocol.post("", "application/json", viewToSpan(wrongSum), writeStarter);
+
+		auto snapshot = statistics.snapshot();
+		doATest(int(snapshot.size()), 2);
+		doATest(snapshot[0].path, "set_message");
+		doATest(snapshot[0].calls, 1);
+		doATest(snapshot[0].errors, 0);
+		doATest(snapshot[1].path, "sum");
+		doATest(snapshot[1].calls, 4);
+		doATest(snapshot[1].errors, 1);
+		doATest(snapshot[1].parsing > std::chrono::nanoseconds(0) && snapshot[1].serialisation > std::chrono::nanoseconds(0), true);
+
+		std::string description = describeInJsonWsp<std::string>(advancedRpc, "dontcallus.com", "Statistics", snapshot);
+		doATest(description.find("\"calls\" : 4,") != std::string::npos, true);
+		doATest(description.find("\"errors\" : 1,") != std::string::npos, true);
+		statistics.reset();
+		doATest(statistics.snapshot()[1].calls, 0);
+
+		// Methods may be destroyed before a snapshot is taken
+		{
+			auto shortLived = std::make_unique<AdvancedRpcClass>();
+			Bomba::JsonRpcServerProtocol shortLivedProtocol = *shortLived;
+			shortLivedProtocol.setCallObserver(&statistics);
+			shortLivedProtocol.post("", "application/json", viewToSpan(advancedRpcRequest3), writeStarter);
+		}
+		snapshot = statistics.snapshot();
+		doATest(int(snapshot.size()), 3);
+		doATest(snapshot[2].path, "sum");
+		doATest(snapshot[1].calls + snapshot[2].calls, 1);
+	}
+
 	const std::string expectedGet =
 			"GET /conspiracy.html HTTP/1.1\r\n"
 			"Host: faecesbook.con\r\n"
@@ -1035,6 +1114,108 @@ R"~(<!doctype html>
 		}
 	}
 
+	{
+		std::cout << "Testing vectorised HTTP header scanning" << std::endl;
+		struct RecordingParser : Bomba::Detail::HttpParseState {
+			std::string read;
+			bool firstLineReader(std::string_view firstLine) override {
+				read += std::string(firstLine) + '\n';
+				return true;
+			}
+			void headerReader(std::string_view property, std::string_view value, std::pair<int, int> location) override {
+				read += std::string(property) + '=' + std::string(value) + '@' + std::to_string(location.first) + '\n';
+			}
+		};
+		// Names and values of all lengths cross the 16 and 32 byte blocks at all positions
+		std::string request = "GET /some/longer/path/to/cross/a/block?with=query HTTP/1.1\r\n";
+		for (int i = 1; i < 70; i++) {
+			std::string name;
+			for (int j = 0; j < i; j++)
+				name += char((j % 3 == 0 ? 'A' : 'a') + (i + j) % 26);
+			request += name + ((i % 4 == 0) ? " : " : ":") + std::string(i % 41, 'V') + "\tEnd" + "\r\n";
+		}
+		request += "Content-Length: 5\r\n\r\nhello";
+
+		auto parseWith = [&] (Bomba::Detail::HttpScanner::Level level, int available) {
+			std::string copy = request;
+			RecordingParser parser;
+			parser.scanLevel = level;
+			auto [reaction, position] = parser.parse(std::span<char>(copy.data(), available));
+			parser.read += std::to_string(int(reaction)) + ' ' + std::to_string(position) + ' ' + std::to_string(parser.bodySize);
+			return parser.read + copy.substr(0, available);
+		};
+		auto detected = Bomba::Detail::HttpScanner::detectLevel();
+		int differences = 0;
+		for (int available : {int(request.size()), int(request.size()) - 7, 200, 61, 33}) {
+			std::string expected = parseWith(Bomba::Detail::HttpScanner::Level::SCALAR, available);
+			for (auto level : {Bomba::Detail::HttpScanner::Level::SSE2, Bomba::Detail::HttpScanner::Level::AVX2}) {
+				if (level <= detected && parseWith(level, available) != expected)
+					differences++;
+			}
+		}
+		doATest(differences, 0);
+		std::string copy = request;
+		RecordingParser parser;
+		doATest(int(parser.parse(std::span<char>(copy.data(), copy.size())).first), int(ServerReaction::OK));
+		doATest(parser.bodySize, 5);
+		doATest(parser.read.find("\nstuvwxyzabcdefghij=VVVVVVVVVVVVVVVVVV\tEnd@") != std::string::npos, true);
+	}
+
+	{
+		std::cout << "Testing resumable HTTP header parsing" << std::endl;
+		struct CountingParser : Bomba::Detail::HttpParseState {
+			int firstLines = 0;
+			int headers = 0;
+			bool firstLineReader(std::string_view) override {
+				firstLines++;
+				return true;
+			}
+			void headerReader(std::string_view, std::string_view, std::pair<int, int>) override {
+				headers++;
+			}
+		};
+		std::string request = "GET / HTTP/1.1\r\nHost: faecesbook.con\r\nCookie: " + std::string(3000, 'c')
+				+ "\r\nContent-Length: 3\r\n\r\nabc";
+		CountingParser parser;
+		int reads = 0;
+		for (int available = 1; available <= std::ssize(request); available++) {
+			auto [reaction, position] = parser.parse(std::span<char>(request.data(), available));
+			reads++;
+			if (reaction != ServerReaction::READ_ON)
+				break;
+		}
+		doATest(reads, int(request.size()) - 3);
+		doATest(parser.headerComplete, true);
+		doATest(parser.firstLines, 1);
+		doATest(parser.headers, 2);
+		doATest(parser.bodySize, 3);
+		doATest(request.substr(parser.parsePosition), "abc");
+
+		Bomba::SimpleGetResponder getResponder;
+		getResponder.resource = someHtml;
+		Bomba::HttpServer<> http = {getResponder};
+		auto session = http.getSession();
+		std::string get = "GET / HTTP/1.1\r\nCookie: " + std::string(3000, 'c') + "\r\n\r\n";
+		std::string response;
+		auto writer = [&] (std::span<const char> written) {
+			response += std::string_view(written.data(), written.size());
+		};
+		ServerReaction reaction = ServerReaction::READ_ON;
+		for (int available = 7; reaction == ServerReaction::READ_ON; available = std::min<int>(available + 7, get.size()))
+			reaction = session.respond(std::span<char>(get.data(), available), writer).first;
+		doATest(int(reaction), int(ServerReaction::OK));
+		doATestIgnoringWhitespace(response, sentHtml);
+
+		http.setMaxHeaderSize(1024);
+		auto limitedSession = http.getSession();
+		response.clear();
+		reaction = ServerReaction::READ_ON;
+		for (int available = 500; reaction == ServerReaction::READ_ON; available = std::min<int>(available + 500, get.size()))
+			reaction = limitedSession.respond(std::span<char>(get.data(), available), writer).first;
+		doATest(int(reaction), int(ServerReaction::DISCONNECT));
+		doATest(response.starts_with("HTTP/1.1 431 Request Header Fields Too Large\r\n"), true);
+	}
+
 	auto makeHttpTestFixture = [&] {
 		struct Fixture {
 			Bomba::SimpleGetResponder getResponder;
@@ -1090,6 +1271,26 @@ R"~(<!doctype html>
 		future1.get();
 	}
 
+	{
+		std::cout << "Testing HTTP with a client that doesn't read responses" << std::endl;
+		auto fixture = makeHttpTestFixture();
+		std::string largeResource(1000000, 'a');
+		fixture.getResponder.resource = largeResource;
+		{
+			Bomba::SyncNetworkClient slowClient = {fixture.targetAddress, fixture.targetPort};
+			Bomba::HttpClient<> slowHttpClient = {slowClient, fixture.targetAddress};
+			for (int i = 0; i < 20; i++)
+				slowHttpClient.get("/");
+			// The server's thread must not get stuck sending to the slow client
+			fixture.methodClient("We are ignored");
+			doATest(rpcTestAssigned, "We are ignored");
+			doATest(fixture.server.bytesQueued() > 0, true);
+		}
+		for (int i = 0; i < 1000 && fixture.server.bytesQueued() > 0; i++)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		doATest(fixture.server.bytesQueued(), 0);
+	}
+
 	{
 		std::cout << "Internally benchmarking HTTP server's GET...";
 		auto fixture = makeHttpTestFixture();
@@ -1099,40 +1300,10 @@ R"~(<!doctype html>
 				return true;
 			});
 		}
-		std::cout << " average response time is " << fixture.server.averageResponseTime().count() << " ns per packet" << std::endl;
-	}
-
-	{
-		std::cout << "Asynchronously benchmarking HTTP server's GET...";
-		auto fixture = makeHttpTestFixture();
-		std::atomic_int totalRequests = 0;
-		auto workload = [&] () {
-			std::array<Bomba::RequestToken, 50000> requests = {};
-			Bomba::SyncNetworkClient client = {fixture.targetAddress, fixture.targetPort};
-			Bomba::HttpClient<> httpClient = {client, fixture.targetAddress};
-			
-			for (Bomba::RequestToken& token : requests)
-				token = httpClient.get("/");
-			// We don't have enough threads to wait for each response individually
-			for (Bomba::RequestToken& token : requests) {
-				httpClient.getResponse(token, [&] (std::span<char>, bool) {
-					totalRequests++;
-					return true;
-				});
-			}
-		};
-		auto startTime = std::chrono::steady_clock::now();
-		{
-			std::vector<std::jthread> workers;
-			for (int i = 0; i < 5; i++)
-				workers.emplace_back(workload);
-			// Destructors wait until they finish
-		}
-		auto endTime = std::chrono::steady_clock::now();
-		int average = std::chrono::duration_cast<std::chrono::nanoseconds>(endTime - startTime).count() / totalRequests;
-		
-		std::cout << " average response time is " << average << " ns per request, " <<
-					fixture.server.averageResponseTime().count() << " ns reported internally" << std::endl;
+		Bomba::LatencySnapshot latency = fixture.server.latency();
+		std::cout << " average response time is " << latency.mean().count() << " ns per packet (p50 " <<
+				latency.percentile(0.5).count() << " ns, p99 " << latency.percentile(0.99).count() << " ns, p99.9 " <<
+				latency.percentile(0.999).count() << " ns, max " << latency.max().count() << " ns)" << std::endl;
 	}
 
 	{
@@ -1215,6 +1386,21 @@ R"~(<!doctype html>
 		doATest(fixture.methodClient.getMessage(), "In 4chan we trust");
 	}
 
+	{
+		std::cout << "Testing pipelined JSON-RPC on localhost" << std::endl;
+		auto fixture = makeJsonRpcTestFixture();
+		std::array<Future<int>, 12> futures = {};
+		auto added = [] (int index) {
+			return (index % 2) ? 1000000 : 0; // Responses of different lengths
+		};
+		for (int i = 0; i < 12; i++)
+			futures[i] = fixture.methodClient.sum.async(i, added(i));
+		int correct = 0;
+		for (int i = 0; i < 12; i++)
+			correct += (futures[i].get() == i + added(i));
+		doATest(correct, 12);
+	}
+
 	{
 		std::cout << "Internally benchmarking the JSON-RPC server...";
 		auto fixture = makeJsonRpcTestFixture();
@@ -1644,6 +1830,7 @@ R"~({
 
 		BinaryFormat<>::Input in(reading.str);
 		in.startReadingArray(noFlags);
+		doATest(in.nextArrayElement(noFlags), true);
 		doATest(in.readInt(SerialisationFlags::INT_8), -7);
 		doATest(in.nextArrayElement(noFlags), true);
 		doATest(in.readInt(SerialisationFlags::INT_8), -3);
@@ -1844,24 +2031,9 @@ R"~({
 		doATest(announcement, statelessLambdaString);
 	}
 
-	auto makeBinaryTestFixture = [&] {
-		struct Fixture {
-			AdvancedRpcClass serverApi;
-			BinaryProtocolServer<> binaryServer = {serverApi};
-			Bomba::BackgroundTcpServer<decltype(binaryServer)> server = {binaryServer, 8901}; // Very unlikely this port will be used for something
-
-			AdvancedRpcClass clientApi;
-			std::string targetAddress = "0.0.0.0";
-			std::string targetPort = "8901";
-			Bomba::SyncNetworkClient client = {targetAddress, targetPort};
-			BinaryProtocolClient<> binaryClient = {clientApi, client};
-		};
-		return Fixture();
-	};
-
 	{
 		std::cout << "Testing binary RPC loop on localhost" << std::endl;
-		auto fixture = makeBinaryTestFixture();
+		BinaryTestFixture fixture;
 		fixture.clientApi.setMessage("Take the red pill");
 		doATest(fixture.serverApi.message, "Take the red pill");
 
@@ -1874,7 +2046,7 @@ R"~({
 
 	{
 		std::cout << "Testing binary RPC out of order" << std::endl;
-		auto fixture = makeBinaryTestFixture();
+		BinaryTestFixture fixture;
 
 		fixture.serverApi.message = "Don't be a blue pill.";
 		Future<std::string> future1 = fixture.clientApi.getMessage();
@@ -1888,9 +2060,771 @@ R"~({
 		doATest(future1.get(), "Don't be a blue pill.");
 	}
 
+	{
+		std::cout << "Testing allocations per request" << std::endl;
+		// Every scenario runs once to fill caches and reserve buffers, then it must not allocate at all
+		auto checkAllocations = [&] (std::string_view scenario, auto&& run) {
+			constexpr int runs = 10;
+			run();
+			AllocationCounting::threadCount = 0;
+			AllocationCounting::threadCountingEnabled = true;
+			for (int i = 0; i < runs; i++)
+				run();
+			AllocationCounting::threadCountingEnabled = false;
+			double allocations = double(AllocationCounting::threadCount) / runs;
+			std::cout << "	" << scenario << ": " << allocations << " allocations per request" << std::endl;
+			doATest(allocations, 0.0);
+		};
+		std::array<char, 512> input = {};
+		int64_t responseSize = 0;
+		ServerReaction reaction = ServerReaction::DISCONNECT;
+		auto respondTo = [&] (auto& session, std::string_view request) {
+			std::copy(request.begin(), request.end(), input.begin()); // Parsing may overwrite it
+			responseSize = 0;
+			reaction = session.respond(std::span<char>(input.data(), request.size()), [&] (std::span<const char> output) {
+				responseSize += output.size();
+			}).first;
+		};
+
+		std::filesystem::path folder = std::filesystem::temp_directory_path() / "bomba_allocation_test";
+		std::filesystem::create_directories(folder);
+		Bomba::CachingFileServer fileServer(folder);
+		fileServer.addGeneratedFile("stylesheets/colourful_page_style.css", "body { color: #ff00ff; }");
+		Bomba::HttpServer<> fileHttp(fileServer);
+		auto fileSession = fileHttp.getSession();
+		checkAllocations("HTTP GET of a cached file", [&] {
+			respondTo(fileSession, "GET /stylesheets/colourful_page_style.css HTTP/1.1\r\nHost: localhost\r\n\r\n");
+		});
+		doATest(int(reaction), int(ServerReaction::OK));
+		doATest(responseSize > 24, true);
+		std::filesystem::remove_all(folder);
+
+		AdvancedRpcClass method;
+		Bomba::JsonRpcServer<std::string> jsonRpc(method);
+		auto jsonRpcSession = jsonRpc.getSession();
+		checkAllocations("JSON-RPC call", [&] {
+			respondTo(jsonRpcSession, expectedJsonRpcRequest);
+		});
+		doATest(int(reaction), int(ServerReaction::OK));
+
+		DummyRpcClass api;
+		api.message = textInBinary;
+		BinaryProtocolServer<> binary(api);
+		auto binarySession = binary.getSession();
+		checkAllocations("binary RPC call", [&] {
+			respondTo(binarySession, binaryRequest1.str);
+		});
+		doATest(int(reaction), int(ServerReaction::OK));
+
+		StandardObject object;
+		ExpandingBuffer<> buffer;
+		checkAllocations("serialising into JSON", [&] {
+			buffer.clear();
+			object.serialise<JSON>(static_cast<GeneralisedBuffer&>(buffer));
+		});
+		checkAllocations("deserialising from JSON", [&] {
+			object.deserialise<JSON>(standardObjectJson);
+		});
+		doATest(object.contents, "Not much at this point");
+	}
+
+	{
+		std::cout << "Testing loopback client" << std::endl;
+		AdvancedRpcClass serverApi;
+		BinaryProtocolServer<> binaryServer = {serverApi};
+		Bomba::LoopbackClient<decltype(binaryServer)> binaryLoopback = {binaryServer};
+		AdvancedRpcClass clientApi;
+		[[maybe_unused]] BinaryProtocolClient<> binaryClient = {clientApi, binaryLoopback};
+		clientApi.setMessage("No sockets were harmed");
+		doATest(serverApi.message, "No sockets were harmed");
+		Future<int> first = clientApi.sum.async(1, 2);
+		Future<int> second = clientApi.sum.async(3, 4);
+		doATest(second.get(), 7); // The first response must be stored for later
+		doATest(first.get(), 3);
+		doATest(binaryLoopback.hasReceivedData(), false);
+
+		Bomba::JsonRpcServer<std::string> jsonRpcServer = {serverApi};
+		Bomba::LoopbackClient<decltype(jsonRpcServer)> jsonRpcLoopback = {jsonRpcServer};
+		[[maybe_unused]] Bomba::JsonRpcClient<> jsonRpcClient = {clientApi, jsonRpcLoopback, "localhost"};
+		serverApi.message = "Nor kernels";
+		doATest(clientApi.getMessage(), "Nor kernels");
+
+		Bomba::SimpleGetResponder getResponder;
+		getResponder.resource = someHtml;
+		Bomba::HttpServer<> httpServer = {getResponder};
+		Bomba::LoopbackClient<decltype(httpServer)> httpLoopback = {httpServer};
+		Bomba::HttpClient<> httpClient = {httpLoopback, "localhost"};
+		httpClient.getResponse(httpClient.get("/"), [&] (std::span<char> response, bool success) {
+			doATest(someHtml, std::string_view(response.data(), response.size()));
+			doATest(success, true);
+			return true;
+		});
+	}
+
+	{
+		std::cout << "Testing chunked HTTP responses" << std::endl;
+		struct LongResponder : Bomba::IHttpGetResponder {
+			int lines = 0;
+			bool get(std::string_view, Bomba::IWriteStarter& writeStarter) override {
+				writeStarter.writeUnknownSize("text/plain", [&] (GeneralisedBuffer& output) {
+					for (int i = 0; i < lines; i++) {
+						output += "Line number ";
+						output += std::string_view(std::to_string(i));
+						output += '\n';
+					}
+				});
+				return true;
+			}
+		} longResponder;
+		std::string expected;
+		longResponder.lines = 1000;
+		for (int i = 0; i < longResponder.lines; i++)
+			expected += "Line number " + std::to_string(i) + '\n';
+
+		Bomba::HttpServer<> httpServer = {longResponder};
+		FakeServer fakeServer = {httpServer};
+		auto [response, reaction] = fakeServer.respond("GET / HTTP/1.1\r\n\r\n");
+		doATest(int(reaction), int(ServerReaction::OK));
+		doATest(response.starts_with("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n"), true);
+		doATest(response.ends_with("\r\n0\r\n\r\n"), true);
+		doATest(response.find("\r\n1000\r\n") != std::string::npos, true); // 4096 bytes in a chunk
+		auto [oldResponse, oldReaction] = fakeServer.respond("GET / HTTP/1.0\r\n\r\n");
+		doATest(oldResponse.starts_with("HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(expected.size())), true);
+		longResponder.lines = 3;
+		auto [shortResponse, shortReaction] = fakeServer.respond("GET / HTTP/1.1\r\n\r\n");
+		doATest(shortResponse, "HTTP/1.1 200 OK\r\nContent-Length: 42        \r\nContent-Type: text/plain\r\n\r\n"
+				"Line number 0\nLine number 1\nLine number 2\n");
+
+		FakeClient client;
+		Bomba::HttpClient<> http(client, "faecesbook.con");
+		int available = 100; // The response arrives in parts, split at various places
+		client.expandResponse = [&] {
+			client.response = response.substr(0, std::min<int>(available, response.size()));
+			available += 1000;
+		};
+		std::string downloaded;
+		auto token = http.get("/");
+		http.getResponse(token, [&] (std::span<char> body, bool success) {
+			doATest(success, true);
+			downloaded = std::string_view(body.data(), body.size());
+			return true;
+		});
+		doATest(downloaded == expected, true);
+		doATest(client.position, int64_t(response.size()));
+
+		available = 100; // Without waiting, an incomplete response is left for the next attempt
+		downloaded.clear();
+		token = http.get("/");
+		int attempts = 1;
+		while (!http.tryToGetResponse(token, [&] (std::span<char> body, bool) {
+			downloaded = std::string_view(body.data(), body.size());
+			return true;
+		}))
+			attempts++;
+		doATest(attempts > 1, true);
+		doATest(downloaded == expected, true);
+
+		longResponder.lines = 1000;
+		Bomba::LoopbackClient<decltype(httpServer)> loopback = {httpServer};
+		Bomba::HttpClient<> loopbackHttp = {loopback, "localhost"};
+		auto first = loopbackHttp.get("/");
+		auto second = loopbackHttp.get("/");
+		for (auto token : {second, first}) { // The first one is stored as a wrong reply when looking for the second one
+			downloaded.clear();
+			loopbackHttp.getResponse(token, [&] (std::span<char> body, bool) {
+				downloaded = std::string_view(body.data(), body.size());
+				return true;
+			});
+			doATest(downloaded == expected, true);
+		}
+	}
+
+	{
+		std::cout << "Testing sharded TCP server" << std::endl;
+		AdvancedRpcClass serverApi;
+		BinaryProtocolServer<> binaryServer = {serverApi};
+		Bomba::BackgroundTcpServer<decltype(binaryServer), Bomba::ShardedTcpServer> server = {binaryServer, 8901, 4};
+		std::atomic_int correct = 0;
+		{
+			std::vector<std::jthread> workers;
+			for (int i = 0; i < 8; i++) {
+				workers.emplace_back([&, i] {
+					Bomba::SyncNetworkClient client = {"0.0.0.0", "8901"};
+					AdvancedRpcClass clientApi;
+					[[maybe_unused]] BinaryProtocolClient<> binaryClient = {clientApi, client};
+					for (int j = 0; j < 100; j++) {
+						if (clientApi.sum(i, j) == i + j)
+							correct++;
+					}
+				});
+			}
+		}
+		doATest(int(correct), 800);
+	}
+
+	{
+		std::cout << "Testing TCP server's connection limit" << std::endl;
+		AdvancedRpcClass serverApi;
+		BinaryProtocolServer<> binaryServer = {serverApi};
+		Bomba::BackgroundTcpServer<decltype(binaryServer)> server = {binaryServer, 8901, 1, 2};
+		auto makeClient = [] {
+			struct Client {
+				Bomba::SyncNetworkClient client = {"0.0.0.0", "8901"};
+				AdvancedRpcClass clientApi;
+				BinaryProtocolClient<> binaryClient = {clientApi, client};
+			};
+			return std::make_unique<Client>();
+		};
+		auto first = makeClient();
+		auto second = makeClient();
+		doATest(first->clientApi.sum(1, 2), 3);
+		doATest(second->clientApi.sum(3, 4), 7);
+		doATest(server.connectionCount(), 2);
+		bool refused = false;
+		try {
+			makeClient()->clientApi.sum(5, 6);
+		} catch (std::exception&) {
+			refused = true;
+		}
+		doATest(refused, true);
+
+		// Closed sessions are reused
+		first.reset();
+		int correct = 0;
+		for (int i = 0; i < 20; i++) {
+			while (server.connectionCount() > 1)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			if (makeClient()->clientApi.sum(i, 1) == i + 1)
+				correct++;
+		}
+		doATest(correct, 20);
+	}
+
+	{
+		std::cout << "Testing tracing" << std::endl;
+		Bomba::TraceRegistry& tracing = Bomba::TraceRegistry::instance();
+		tracing.clear();
+		{
+			Bomba::TraceScope outer("outer");
+			std::jthread([] {
+				Bomba::TraceScope inner("other thread");
+			});
+		}
+		std::string trace = tracing.chromeTrace();
+		doATest(trace.starts_with("{\"traceEvents\":["), true);
+		doATest(trace.find("{\"name\":\"outer\",\"ph\":\"B\"") != std::string::npos, true);
+		doATest(trace.find("{\"name\":\"outer\",\"ph\":\"E\"") != std::string::npos, true);
+		doATest(trace.find("{\"name\":\"other thread\",\"ph\":\"E\"") != std::string::npos, true);
+
+		Bomba::TraceBuffer buffer(1);
+		for (int i = 0; i < int(Bomba::TraceBuffer::Capacity) + 10; i++)
+			buffer.record(i % 2 ? "odd" : "even", i % 2);
+		auto events = buffer.read();
+		doATest(int(events.size()), int(Bomba::TraceBuffer::Capacity));
+		doATest(std::string_view(events.front().name), "even"); // The first 10 were overwritten
+		tracing.clear();
+		doATest(tracing.chromeTrace(), "{\"traceEvents\":[\n]}\n");
+	}
+
+	{
+		std::cout << "Testing latency histogram" << std::endl;
+		Bomba::LatencyHistogram histogram;
+		for (int i = 1; i <= 1000; i++)
+			histogram.record(std::chrono::microseconds(i));
+		Bomba::LatencySnapshot snapshot;
+		histogram.addTo(snapshot);
+		doATest(snapshot.count(), 1000);
+		doATest(snapshot.mean().count(), 500500);
+		auto withinError = [] (std::chrono::nanoseconds measured, int64_t expected) {
+			return measured.count() >= expected && measured.count() <= expected + expected / 32;
+		};
+		doATest(withinError(snapshot.percentile(0.5), 500000), true);
+		doATest(withinError(snapshot.percentile(0.99), 990000), true);
+		doATest(withinError(snapshot.max(), 1000000), true);
+		doATest(withinError(snapshot.percentile(0.001), 1000), true);
+
+		Bomba::LatencySnapshot total = snapshot;
+		total += snapshot;
+		doATest(total.count(), 2000);
+		doATest(withinError(total.percentile(0.5), 500000), true);
+		total -= snapshot;
+		doATest(total.count(), 1000);
+	}
+
+	{
+		std::cout << "Testing TCP server's latency tracking" << std::endl;
+		AdvancedRpcClass serverApi;
+		BinaryProtocolServer<> binaryServer = {serverApi};
+		Bomba::BackgroundTcpServer<decltype(binaryServer)> server = {binaryServer, 8901};
+		Bomba::SyncNetworkClient client = {"0.0.0.0", "8901"};
+		AdvancedRpcClass clientApi;
+		[[maybe_unused]] BinaryProtocolClient<> binaryClient = {clientApi, client};
+
+		for (int i = 0; i < 100; i++)
+			clientApi.sum(i, 1);
+		Bomba::LatencySnapshot latency = server.latency();
+		doATest(latency.count(), 100);
+		doATest(latency.percentile(0.5) <= latency.percentile(0.99) && latency.percentile(0.99) <= latency.max(), true);
+		doATest(latency.max() > std::chrono::nanoseconds(0), true);
+		server.resetLatency();
+		doATest(server.latency().count(), 0);
+		clientApi.sum(2, 3);
+		doATest(server.latency().count(), 1);
+	}
+
+	{
+		std::cout << "Testing metrics page" << std::endl;
+		Bomba::MetricsGetResponder metricsResponder;
+		Bomba::HttpServer<> httpServer = {metricsResponder};
+		Bomba::BackgroundTcpServer<decltype(httpServer)> server = {httpServer, 8901};
+		metricsResponder.addServer("http", server);
+		std::string targetAddress = "0.0.0.0";
+		Bomba::SyncNetworkClient client = {targetAddress, "8901"};
+		Bomba::HttpClient<> httpClient = {client, targetAddress};
+		auto get = [&] (std::string_view path) {
+			std::string result;
+			httpClient.getResponse(httpClient.get(path), [&] (std::span<char> response, bool) {
+				result = std::string(response.data(), response.size());
+				return true;
+			});
+			return result;
+		};
+
+		get("/metrics");
+		std::string page = get("/metrics"); // Counted before this request is finished
+		doATest(page.find("bomba_sessions{server=\"http\"} 1\n") != std::string::npos, true);
+		doATest(page.find("bomba_connections_accepted_total{server=\"http\"} 1\n") != std::string::npos, true);
+		doATest(page.find("bomba_errors_total{server=\"http\",reason=\"rejected\"} 0\n") != std::string::npos, true);
+		doATest(page.find("bomba_requests_total{server=\"http\"} 1\n") != std::string::npos, true);
+		doATest(page.find("bomba_response_time_seconds{server=\"http\",quantile=\"0.99\"} ") != std::string::npos, true);
+		doATest(page.find("bomba_received_bytes_total{server=\"http\"} 0\n"), std::string::npos);
+
+		std::string json = get("/metrics.json");
+		doATest(json.find("\"requests\" : 2,") != std::string::npos, true);
+		doATest(json.find("\"sessions\" : 1,") != std::string::npos, true);
+		doATest(json.find("\"bytesSent\" : 0,"), std::string::npos);
+		doATest(server.metrics().latency.count(), 3);
+	}
+
+	{
+		std::cout << "Testing traffic capture and replay" << std::endl;
+		Bomba::SimpleGetResponder getResponder;
+		getResponder.resource = someHtml;
+		Bomba::HttpServer<> httpServer = {getResponder};
+		std::string fileName = (std::filesystem::temp_directory_path() / "bomba_capture_test.bin").string();
+		{
+			Bomba::TrafficCapture capture(fileName, 1 << 20);
+			Bomba::RecordingResponder recording(httpServer, capture);
+			Bomba::BackgroundTcpServer<decltype(recording)> server = {recording, 8901};
+			std::string targetAddress = "0.0.0.0";
+			for (int connection = 0; connection < 2; connection++) {
+				Bomba::SyncNetworkClient client = {targetAddress, "8901"};
+				Bomba::HttpClient<> httpClient = {client, targetAddress};
+				for (int i = 0; i < 3; i++) {
+					httpClient.getResponse(httpClient.get("/"), [&] (std::span<char> response, bool) {
+						doATest(someHtml, std::string_view(response.data(), response.size()));
+						return true;
+					});
+				}
+			}
+			doATest(capture.dropped(), 0);
+		}
+
+		Bomba::TrafficReplay replay(fileName);
+		Bomba::HttpServer<> replayedServer = {getResponder};
+		Bomba::TrafficReplayResults results = replay.replay(replayedServer);
+		doATest(results.sessions, 2);
+		doATest(results.messages, 6);
+		doATest(results.disconnected, 0);
+		doATest(results.bytesSent > int64_t(6 * someHtml.size()), true);
+		Bomba::TrafficReplayResults paced = replay.replay(replayedServer, true);
+		doATest(paced.messages, 6);
+		doATest(paced.bytesSent, results.bytesSent);
+		std::filesystem::remove(fileName);
+	}
+
+	{
+		std::cout << "Testing TCP server's message size limit" << std::endl;
+		AdvancedRpcClass serverApi;
+		BinaryProtocolServer<> binaryServer = {serverApi};
+		Bomba::BackgroundTcpServer<decltype(binaryServer)> server = {binaryServer, 8901};
+		server.setMaxMessageSize(40000);
+		Bomba::SyncNetworkClient client = {"0.0.0.0", "8901"};
+		AdvancedRpcClass clientApi;
+		[[maybe_unused]] BinaryProtocolClient<> binaryClient = {clientApi, client};
+
+		// Received in many parts into a growing buffer
+		std::string longMessage(30000, 'y');
+		clientApi.setMessage(longMessage);
+		doATest(serverApi.message == longMessage, true);
+		doATest(clientApi.sum(2, 3), 5);
+
+		bool disconnected = false;
+		try {
+			clientApi.setMessage(std::string(50000, 'z'));
+		} catch (std::exception&) {
+			disconnected = true;
+		}
+		doATest(disconnected, true);
+		doATest(serverApi.message == longMessage, true);
+	}
+
+	{
+		std::cout << "Testing TCP server's timeouts" << std::endl;
+		auto write = [] (int socket, std::string_view written) {
+			::send(socket, written.data(), written.size(), MSG_NOSIGNAL);
+		};
+		auto stillOpen = [] (int socket) {
+			char received = 0;
+			return ::recv(socket, &received, 1, MSG_DONTWAIT) < 0 && errno == EAGAIN;
+		};
+		auto closedByServer = [] (int socket) {
+			std::array<char, 256> received;
+			int length = 0;
+			while ((length = ::read(socket, received.data(), received.size())) > 0);
+			::close(socket);
+			return length == 0;
+		};
+		auto testTimeouts = [&] (auto& server) {
+			using namespace std::chrono_literals;
+			server.setTimeouts({.idle = 400ms, .header = 200ms, .body = 500ms});
+			std::string_view request = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+			std::array<char, 256> response;
+
+			// Activity postpones the idle time limit
+			int idle = connectRawSocket();
+			for (int i = 0; i < 3; i++) {
+				write(idle, request);
+				[[maybe_unused]] auto read = ::read(idle, response.data(), response.size());
+				std::this_thread::sleep_for(250ms);
+			}
+			doATest(stillOpen(idle), true);
+			doATest(closedByServer(idle), true);
+
+			// Sending the header slowly doesn't prevent its time limit from expiring
+			int slow = connectRawSocket();
+			write(slow, "GET / HTTP/1.1\r\n");
+			for (int i = 0; i < 8 && stillOpen(slow); i++) {
+				std::this_thread::sleep_for(50ms);
+				write(slow, "X-Padding: slow\r\n");
+			}
+			doATest(closedByServer(slow), true);
+
+			// After the header arrives, the body's time limit applies
+			int body = connectRawSocket();
+			write(body, "POST / HTTP/1.1\r\nContent-Length: 10\r\n\r\n12345");
+			std::this_thread::sleep_for(300ms);
+			doATest(stillOpen(body), true);
+			doATest(closedByServer(body), true);
+			std::this_thread::sleep_for(50ms); // The server may finish closing after the client noticed
+			doATest(server.connectionCount(), 0);
+		};
+
+		Bomba::SimpleGetResponder getResponder;
+		getResponder.resource = "Hi";
+		Bomba::HttpServer<> httpServer = {getResponder};
+		{
+			Bomba::BackgroundTcpServer<decltype(httpServer)> server = {httpServer, 8901};
+			testTimeouts(server);
+		}
+		{
+			Bomba::BackgroundTcpServer<decltype(httpServer), Bomba::IoUringTcpServer> server = {httpServer, 8901};
+			testTimeouts(server);
+		}
+	}
+
+	{
+		std::cout << "Testing TCP server with an executor" << std::endl;
+		struct PathResponder : Bomba::IHttpGetResponder {
+			bool get(std::string_view path, Bomba::IWriteStarter& writeResponse) override {
+				if (path == "/slow")
+					std::this_thread::sleep_for(std::chrono::milliseconds(300));
+				writeResponse.writeKnownSize(std::string_view("text/plain"), path.size(), [&] (Bomba::GeneralisedBuffer& response) {
+					response += path;
+				});
+				return true;
+			}
+		} pathResponder;
+		Bomba::HttpServer<> httpServer = {pathResponder};
+		Bomba::ThreadPool executor(2);
+		auto request = [] (int socket, std::string_view written) {
+			::send(socket, written.data(), written.size(), MSG_NOSIGNAL);
+		};
+		auto readUntil = [] (int socket, std::string_view ending) {
+			std::string received;
+			std::array<char, 256> chunk;
+			while (!received.ends_with(ending)) {
+				int length = ::read(socket, chunk.data(), chunk.size());
+				if (length <= 0)
+					break;
+				received.append(chunk.data(), length);
+			}
+			return received;
+		};
+		auto testExecutor = [&] (auto& server) {
+			server.setExecutor(&executor);
+			int slow = connectRawSocket();
+			int fast = connectRawSocket();
+			// The slow request doesn't delay another client, pipelined responses keep their order
+			request(slow, "GET /slow HTTP/1.1\r\n\r\nGET /after HTTP/1.1\r\n\r\n");
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			auto start = std::chrono::steady_clock::now();
+			request(fast, "GET /fast HTTP/1.1\r\n\r\n");
+			doATest(readUntil(fast, "/fast").ends_with("/fast"), true);
+			doATest(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(150), true);
+			std::string responses = readUntil(slow, "/after");
+			doATest(responses.ends_with("/after"), true);
+			doATest(responses.find("/slow") < responses.find("/after"), true);
+			::close(slow);
+			::close(fast);
+		};
+		{
+			Bomba::BackgroundTcpServer<decltype(httpServer)> server = {httpServer, 8901};
+			testExecutor(server);
+		}
+		{
+			Bomba::BackgroundTcpServer<decltype(httpServer), Bomba::IoUringTcpServer> server = {httpServer, 8901};
+			testExecutor(server);
+		}
+	}
+
+	{
+		std::cout << "Testing streaming of long HTTP responses" << std::endl;
+		// The responder doesn't finish the response until the client confirms the start of it arrived
+		struct WaitingResponder : Bomba::IHttpGetResponder {
+			std::atomic<bool> startArrived = false;
+			bool waitedSuccessfully = false;
+			bool get(std::string_view, Bomba::IWriteStarter& writeStarter) override {
+				writeStarter.writeUnknownSize("text/plain", [&] (GeneralisedBuffer& output) {
+					for (int i = 0; i < 64; i++)
+						output += std::string_view(std::string(1024, 'a'));
+					auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+					while (!startArrived && std::chrono::steady_clock::now() < deadline)
+						std::this_thread::sleep_for(std::chrono::milliseconds(1));
+					waitedSuccessfully = startArrived;
+					output += "end";
+				});
+				return true;
+			}
+		} waitingResponder;
+		Bomba::HttpServer<> httpServer = {waitingResponder};
+
+		auto testStreaming = [&] (auto& server) {
+			waitingResponder.startArrived = false;
+			waitingResponder.waitedSuccessfully = false;
+			int socket = connectRawSocket();
+			std::string_view request = "GET / HTTP/1.1\r\n\r\n";
+			::send(socket, request.data(), request.size(), MSG_NOSIGNAL);
+			std::string received;
+			std::array<char, 4096> buffer;
+			while (received.size() < 1024) {
+				int length = ::recv(socket, buffer.data(), buffer.size(), 0);
+				if (length <= 0)
+					break;
+				received.append(buffer.data(), length);
+			}
+			waitingResponder.startArrived = (received.size() >= 1024);
+			while (!received.ends_with("\r\n0\r\n\r\n")) {
+				int length = ::recv(socket, buffer.data(), buffer.size(), 0);
+				if (length <= 0)
+					break;
+				received.append(buffer.data(), length);
+			}
+			::close(socket);
+			doATest(waitingResponder.waitedSuccessfully, true);
+			doATest(received.starts_with("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n"), true);
+			doATest(received.ends_with("end\r\n0\r\n\r\n"), true);
+		};
+		{
+			Bomba::BackgroundTcpServer<decltype(httpServer)> server = {httpServer, 8901};
+			testStreaming(server);
+		}
+		{
+			Bomba::BackgroundTcpServer<decltype(httpServer), Bomba::IoUringTcpServer> server = {httpServer, 8901};
+			testStreaming(server);
+		}
+	}
+
+	{
+		std::cout << "Testing io_uring TCP server" << std::endl;
+		AdvancedRpcClass serverApi;
+		BinaryProtocolServer<> binaryServer = {serverApi};
+		Bomba::BackgroundTcpServer<decltype(binaryServer), Bomba::IoUringTcpServer> server = {binaryServer, 8901};
+		Bomba::SyncNetworkClient client = {"0.0.0.0", "8901"};
+		AdvancedRpcClass clientApi;
+		[[maybe_unused]] BinaryProtocolClient<> binaryClient = {clientApi, client};
+
+		// Longer than one receive buffer, so it must be assembled from several
+		std::string longMessage(10000, 'x');
+		clientApi.setMessage(longMessage);
+		doATest(serverApi.message.size(), longMessage.size());
+		Future<int> future1 = clientApi.sum.async(1, 2);
+		Future<int> future2 = clientApi.sum.async(3, 4);
+		doATest(future2.get(), 7);
+		doATest(future1.get(), 3);
+	}
+
+	{
+		std::cout << "Testing sharded io_uring TCP server" << std::endl;
+		AdvancedRpcClass serverApi;
+		BinaryProtocolServer<> binaryServer = {serverApi};
+		Bomba::BackgroundTcpServer<decltype(binaryServer), Bomba::ShardedIoUringTcpServer> server = {binaryServer, 8901, 4};
+		std::atomic_int correct = 0;
+		{
+			std::vector<std::jthread> workers;
+			for (int i = 0; i < 8; i++) {
+				workers.emplace_back([&, i] {
+					Bomba::SyncNetworkClient client = {"0.0.0.0", "8901"};
+					AdvancedRpcClass clientApi;
+					[[maybe_unused]] BinaryProtocolClient<> binaryClient = {clientApi, client};
+					for (int j = 0; j < 100; j++) {
+						if (clientApi.sum(i, j) == i + j)
+							correct++;
+					}
+				});
+			}
+		}
+		doATest(int(correct), 800);
+	}
+
+	{
+		std::cout << "Testing Unix domain sockets" << std::endl;
+		std::string path = (std::filesystem::temp_directory_path() / "bomba_test.sock").string();
+		AdvancedRpcClass serverApi;
+		{
+			Bomba::JsonRpcServer<std::string> jsonRpcServer = {serverApi};
+			Bomba::BackgroundTcpServer<decltype(jsonRpcServer)> server = {jsonRpcServer, Bomba::UnixSocketPath{path}, 2};
+			Bomba::SyncNetworkClient client = {Bomba::UnixSocketPath{path}};
+			AdvancedRpcClass clientApi;
+			[[maybe_unused]] Bomba::JsonRpcClient<> jsonRpcClient = {clientApi, client, "localhost"};
+			clientApi.setMessage("Sidecars welcome");
+			doATest(serverApi.message, "Sidecars welcome");
+			Future<int> future1 = clientApi.sum.async(1, 2);
+			Future<int> future2 = clientApi.sum.async(3, 4);
+			doATest(future2.get(), 7);
+			doATest(future1.get(), 3);
+		}
+		doATest(std::filesystem::exists(path), false);
+		{
+			BinaryProtocolServer<> binaryServer = {serverApi};
+			Bomba::BackgroundTcpServer<decltype(binaryServer), Bomba::IoUringTcpServer> server = {binaryServer, Bomba::UnixSocketPath{path}};
+			Bomba::SyncNetworkClient client = {Bomba::UnixSocketPath{path}};
+			AdvancedRpcClass clientApi;
+			[[maybe_unused]] BinaryProtocolClient<> binaryClient = {clientApi, client};
+			std::string longMessage(10000, 'u');
+			clientApi.setMessage(longMessage);
+			doATest(serverApi.message == longMessage, true);
+			doATest(clientApi.sum(5, 6), 11);
+		}
+		doATest(std::filesystem::exists(path), false);
+	}
+
+	{
+		std::cout << "Testing shared memory transport" << std::endl;
+		std::string path = (std::filesystem::temp_directory_path() / "bomba_test_shared").string();
+		AdvancedRpcClass serverApi;
+		BinaryProtocolServer<> binaryServer = {serverApi};
+		{
+			Bomba::SharedMemoryServer<decltype(binaryServer)> server = {binaryServer, path, 4096};
+			std::jthread serverThread([&] {
+				server.run();
+			});
+			{
+				Bomba::SharedMemoryClient client = {path};
+				AdvancedRpcClass clientApi;
+				[[maybe_unused]] BinaryProtocolClient<> binaryClient = {clientApi, client};
+				// Longer than the ring, so it must be written while the server is reading it
+				std::string longMessage(10000, 's');
+				clientApi.setMessage(longMessage);
+				doATest(serverApi.message == longMessage, true);
+				Future<int> future1 = clientApi.sum.async(1, 2);
+				Future<int> future2 = clientApi.sum.async(3, 4);
+				doATest(future2.get(), 7);
+				doATest(future1.get(), 3);
+				int correct = 0;
+				for (int i = 0; i < 1000; i++) {
+					if (clientApi.sum(i, 1) == i + 1)
+						correct++;
+				}
+				doATest(correct, 1000);
+				client.setSpins(-1); // Polls without sleeping
+				doATest(clientApi.sum(20, 22), 42);
+
+				server.stopRunning();
+				serverThread.join();
+				client.setSpins(16);
+				bool failed = false;
+				try {
+					clientApi.sum(1, 1);
+				} catch (Bomba::RemoteError&) {
+					failed = true;
+				}
+				doATest(failed, true);
+			}
+		}
+		doATest(std::filesystem::exists(path), false);
+	}
+
+	{
+		std::cout << "Testing UDP transport" << std::endl;
+		AdvancedRpcClass serverApi;
+		BinaryProtocolServer<> binaryServer = {serverApi};
+		Bomba::UdpServer<decltype(binaryServer)> server = {binaryServer, 8901};
+		std::jthread serverThread([&] {
+			server.run();
+		});
+		{
+			Bomba::UdpClient client = {"127.0.0.1", "8901"};
+			AdvancedRpcClass clientApi;
+			[[maybe_unused]] BinaryProtocolClient<> binaryClient = {clientApi, client};
+			clientApi.setMessage("Datagrams are fine");
+			doATest(serverApi.message, "Datagrams are fine");
+			std::array<Future<int>, 20> futures = {}; // More than fit into one batch
+			for (int i = 0; i < std::ssize(futures); i++)
+				futures[i] = clientApi.sum.async(i, 1);
+			int correct = 0;
+			for (int i = std::ssize(futures) - 1; i >= 0; i--) {
+				if (futures[i].get() == i + 1)
+					correct++;
+			}
+			doATest(correct, 20);
+
+			std::vector<char> tooLong(Bomba::Detail::MaxUdpPayloadSize + 1);
+			bool refused = false;
+			try {
+				client.writeRequest(tooLong);
+			} catch (std::logic_error&) {
+				refused = true;
+			}
+			doATest(refused, true);
+		}
+		doATest(server.droppedCount(), 0);
+
+		server.setResponding(false);
+		{
+			Bomba::UdpClient client = {"127.0.0.1", "8901"};
+			AdvancedRpcClass clientApi;
+			[[maybe_unused]] BinaryProtocolClient<> binaryClient = {clientApi, client};
+			clientApi.setMessage.async("Just a notification"); // The response isn't needed
+			client.flush();
+			for (int i = 0; i < 100 && serverApi.message != "Just a notification"; i++)
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			doATest(serverApi.message, "Just a notification");
+			client.setTimeout(std::chrono::milliseconds(20));
+			bool timedOut = false;
+			try {
+				clientApi.sum(1, 2);
+			} catch (std::exception&) {
+				timedOut = true;
+			}
+			doATest(timedOut, true);
+		}
+		server.stopRunning();
+	}
+
 	{
 		std::cout << "Internally benchmarking binary RPC server...";
-		auto fixture = makeBinaryTestFixture();
+		BinaryTestFixture fixture;
 		for (int i = 0; i < 2000; i++) {
 			fixture.clientApi.sum(12, 35);
 		}
@@ -1898,35 +2832,48 @@ R"~({
 	}
 
 	{
-		std::cout << "Asynchronously benchmarking binary RPC server...";
-		auto fixture = makeBinaryTestFixture();
-		std::atomic_int totalRequests = 0;
-		auto workload = [&] () {
-			std::array<Future<int>, 50000> requests = {};
-			Bomba::SyncNetworkClient client = {fixture.targetAddress, fixture.targetPort};
-			AdvancedRpcClass clientApi;
-			BinaryProtocolClient<> binaryClient = {clientApi, client};
-
-			for (Future<int>& future : requests)
-				future = clientApi.sum.async(15, 25);
-			// We don't have enough threads to wait for each response individually
-			for (Future<int>& future : requests) {
-				future.get();
-				totalRequests++;
+		std::cout << "Measuring memory per idle connection..." << std::endl;
+		constexpr int connections = 2000;
+		auto heapUsed = [] {
+			struct mallinfo2 info = mallinfo2();
+			return int64_t(info.uordblks + info.hblkhd); // Large blocks are allocated separately
+		};
+		auto measure = [&] (auto makeServer) {
+			Bomba::SimpleGetResponder getResponder;
+			getResponder.resource = "Idle";
+			Bomba::HttpServer<> httpServer = {getResponder};
+			std::vector<int> sockets;
+			sockets.reserve(connections);
+			int64_t before = heapUsed();
+			auto server = makeServer(httpServer);
+			for (int i = 0; i < connections; i++) {
+				sockets.push_back(connectRawSocket());
 			}
+			// Every connection is used once and then stays idle
+			std::string_view request = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+			std::array<char, 256> response;
+			for (int socket : sockets) {
+				[[maybe_unused]] auto written = ::write(socket, request.data(), request.size());
+				[[maybe_unused]] auto read = ::read(socket, response.data(), response.size());
+			}
+			int64_t after = heapUsed();
+			int accepted = server->connectionCount();
+			for (int socket : sockets)
+				::close(socket);
+			return std::make_pair((after - before) / connections, accepted);
 		};
-		auto startTime = std::chrono::steady_clock::now();
-		{
-			std::vector<std::jthread> workers;
-			for (int i = 0; i < 5; i++)
-				workers.emplace_back(workload);
-			// Destructors wait until they finish
-		}
-		auto endTime = std::chrono::steady_clock::now();
-		int average = std::chrono::duration_cast<std::chrono::nanoseconds>(endTime - startTime).count() / totalRequests;
 
-		std::cout << " average response time is " << average << " ns per request, " <<
-					fixture.server.averageResponseTime().count() << " ns reported internally" << std::endl;
+		auto [netBytes, netAccepted] = measure([&] (auto& httpServer) {
+			return std::make_unique<Bomba::BackgroundTcpServer<std::decay_t<decltype(httpServer)>>>(httpServer, 8901, 1, connections);
+		});
+		doATest(netAccepted, connections);
+		std::cout << "	TcpServer: " << netBytes << " bytes per connection" << std::endl;
+		auto [uringBytes, uringAccepted] = measure([&] (auto& httpServer) {
+			return std::make_unique<Bomba::BackgroundTcpServer<std::decay_t<decltype(httpServer)>, Bomba::IoUringTcpServer>>(
+					httpServer, 8901, connections);
+		});
+		doATest(uringAccepted, connections);
+		std::cout << "	IoUringTcpServer: " << uringBytes << " bytes per connection" << std::endl;
 	}
 
 	std::cout << "Passed: " << (tests - errors) << " / " << tests << ", errors: " << errors << std::endl;
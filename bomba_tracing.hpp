@@ -0,0 +1,188 @@
+#ifndef BOMBA_TRACING_HPP
+#define BOMBA_TRACING_HPP
+
+// Records the beginnings and ends of stages of request processing, dumpable in the Chrome trace format (viewable in Perfetto
+// or chrome://tracing). The library records events only if BOMBA_TRACING is defined, otherwise the macros in bomba_core.hpp
+// are empty and nothing is recorded. Doesn't depend on the rest of the library.
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+
+#ifndef BOMBA_TRACE_BUFFER_SIZE
+#define BOMBA_TRACE_BUFFER_SIZE 65536 // Events remembered per thread, must be a power of two
+#endif
+
+namespace Bomba {
+
+// A ring of the latest events of one thread, only that thread writes, any thread can read without stopping it
+class TraceBuffer {
+public:
+	constexpr static uint64_t Capacity = BOMBA_TRACE_BUFFER_SIZE;
+	static_assert((Capacity & (Capacity - 1)) == 0, "BOMBA_TRACE_BUFFER_SIZE must be a power of two");
+
+	struct Event {
+		const char* name = nullptr;
+		int64_t time = 0; // Nanoseconds of steady_clock
+		bool end = false;
+	};
+
+private:
+	struct StoredEvent {
+		std::atomic<const char*> name = nullptr;
+		std::atomic<int64_t> stamp = 0; // Time shifted left by one, the lowest bit tells if it's an end
+	};
+	std::unique_ptr<StoredEvent[]> _events = std::make_unique<StoredEvent[]>(Capacity);
+	std::atomic<uint64_t> _started = 0; // Events whose writing has started, a reader discards those they could overwrite
+	std::atomic<uint64_t> _written = 0;
+	std::atomic<uint64_t> _cleared = 0; // Events before this one are not read
+	int _thread = 0;
+
+public:
+	TraceBuffer(int thread) : _thread(thread) {}
+
+	int thread() const {
+		return _thread;
+	}
+
+	void record(const char* name, bool end) {
+		int64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		uint64_t index = _written.load(std::memory_order_relaxed);
+		_started.store(index + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		StoredEvent& event = _events[index & (Capacity - 1)];
+		event.name.store(name, std::memory_order_relaxed);
+		event.stamp.store((time << 1) | int64_t(end), std::memory_order_relaxed);
+		_written.store(index + 1, std::memory_order_release);
+	}
+
+	// Copies the remembered events in order, events overwritten while copying are left out
+	std::vector<Event> read() const {
+		uint64_t end = _written.load(std::memory_order_acquire);
+		uint64_t start = std::max(end > Capacity ? end - Capacity : 0, _cleared.load(std::memory_order_relaxed));
+		std::vector<Event> copied;
+		copied.reserve(end - start);
+		for (uint64_t i = start; i < end; i++) {
+			const StoredEvent& event = _events[i & (Capacity - 1)];
+			int64_t stamp = event.stamp.load(std::memory_order_relaxed);
+			copied.push_back({event.name.load(std::memory_order_relaxed), stamp >> 1, bool(stamp & 1)});
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t started = _started.load(std::memory_order_relaxed);
+		uint64_t overwritten = started > Capacity ? started - Capacity : 0;
+		if (overwritten > start)
+			copied.erase(copied.begin(), copied.begin() + std::min<uint64_t>(overwritten - start, copied.size()));
+		return copied;
+	}
+
+	void clear() {
+		_cleared.store(_written.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+};
+
+// Keeps the buffers of all threads that recorded something, also after the threads end
+class TraceRegistry {
+	std::mutex _lock; // Only for adding threads and reading
+	std::vector<std::shared_ptr<TraceBuffer>> _buffers;
+
+	static void writeNumber(std::string& output, int64_t number) {
+		std::array<char, 24> bytes = {};
+		auto written = std::to_chars(bytes.data(), bytes.data() + bytes.size(), number);
+		output.append(bytes.data(), written.ptr);
+	}
+
+public:
+	static TraceRegistry& instance() {
+		static TraceRegistry registry;
+		return registry;
+	}
+
+	TraceBuffer& threadBuffer() {
+		thread_local std::shared_ptr<TraceBuffer> buffer = [this] {
+			std::lock_guard lock(_lock);
+			return _buffers.emplace_back(std::make_shared<TraceBuffer>(_buffers.size() + 1));
+		}();
+		return *buffer;
+	}
+
+	// The events of all threads in the Chrome trace format, times are in microseconds since the earliest event.
+	// Event names are written without escaping, so they must not contain quotes or backslashes.
+	std::string chromeTrace() {
+		std::vector<std::pair<int, std::vector<TraceBuffer::Event>>> threads;
+		{
+			std::lock_guard lock(_lock);
+			for (auto& buffer : _buffers) {
+				threads.emplace_back(buffer->thread(), buffer->read());
+			}
+		}
+		int64_t earliest = INT64_MAX;
+		for (auto& [thread, events] : threads) {
+			if (!events.empty())
+				earliest = std::min(earliest, events.front().time);
+		}
+
+		std::string output = "{\"traceEvents\":[";
+		bool first = true;
+		for (auto& [thread, events] : threads) {
+			for (const TraceBuffer::Event& event : events) {
+				if (!first)
+					output += ',';
+				first = false;
+				output += "\n{\"name\":\"";
+				output += event.name;
+				output += event.end ? "\",\"ph\":\"E\",\"pid\":1,\"tid\":" : "\",\"ph\":\"B\",\"pid\":1,\"tid\":";
+				writeNumber(output, thread);
+				output += ",\"ts\":";
+				int64_t time = event.time - earliest;
+				writeNumber(output, time / 1000);
+				output += '.';
+				int64_t fraction = time % 1000;
+				output += char('0' + fraction / 100);
+				output += char('0' + fraction / 10 % 10);
+				output += char('0' + fraction % 10);
+				output += '}';
+			}
+		}
+		output += "\n]}\n";
+		return output;
+	}
+
+	void clear() {
+		std::lock_guard lock(_lock);
+		for (auto& buffer : _buffers) {
+			buffer->clear();
+		}
+	}
+};
+
+inline void traceEvent(const char* name, bool end) {
+	TraceRegistry::instance().threadBuffer().record(name, end);
+}
+
+// Records the beginning when created and the end when destroyed
+class TraceScope {
+	const char* _name;
+
+public:
+	TraceScope(const char* name) : _name(name) {
+		traceEvent(_name, false);
+	}
+	TraceScope(const TraceScope&) = delete;
+	void operator=(const TraceScope&) = delete;
+
+	~TraceScope() {
+		traceEvent(_name, true);
+	}
+};
+
+} // namespace Bomba
+
+#endif // BOMBA_TRACING_HPP
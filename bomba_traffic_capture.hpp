@@ -0,0 +1,303 @@
+#ifndef BOMBA_TRAFFIC_CAPTURE
+#define BOMBA_TRAFFIC_CAPTURE
+
+#ifndef BOMBA_CORE // Needed to run in godbolt
+#include "bomba_core.hpp"
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Bomba {
+
+// The capture file starts with a header and continues with records, each aligned to 8 bytes and followed by its data.
+// A record's kind is written last, so a reader stops at a record that is zero or unfinished.
+struct TrafficCaptureFormat {
+	constexpr static std::string_view Magic = "BOMBACAP";
+	constexpr static uint32_t Version = 1;
+
+	struct Header {
+		std::array<char, 8> magic;
+		uint32_t version;
+		uint32_t reserved;
+	};
+
+	enum class Kind : uint32_t {
+		END = 0,
+		RECEIVED = 1, // Bytes received from the client
+		CLOSED = 2, // The connection was closed
+	};
+
+	struct Record {
+		uint32_t kind;
+		uint32_t size; // Of the data after the record, without the padding
+		uint64_t session;
+		int64_t time; // Nanoseconds since the capture started
+	};
+
+	constexpr static int64_t recordSize(int64_t dataSize) {
+		return (sizeof(Record) + dataSize + 7) & ~int64_t(7);
+	}
+};
+
+// Writes requests of any number of sessions into an append-only file mapped into memory, can be written from many threads.
+// Space is reserved for the file when it's created, records that don't fit are dropped.
+class TrafficCapture {
+	int _file = -1;
+	char* _mapped = nullptr;
+	int64_t _capacity = 0;
+	std::atomic<int64_t> _tail = sizeof(TrafficCaptureFormat::Header);
+	std::atomic<uint64_t> _sessions = 0;
+	std::atomic<int64_t> _dropped = 0;
+	std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+
+	void write(TrafficCaptureFormat::Kind kind, uint64_t session, std::span<const char> data) {
+		int64_t size = TrafficCaptureFormat::recordSize(data.size());
+		int64_t position = _tail.fetch_add(size, std::memory_order_relaxed);
+		if (position + size > _capacity) [[unlikely]] {
+			_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		TrafficCaptureFormat::Record* record = reinterpret_cast<TrafficCaptureFormat::Record*>(_mapped + position);
+		record->size = data.size();
+		record->session = session;
+		record->time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+		memcpy(record + 1, data.data(), data.size());
+		std::atomic_ref<uint32_t>(record->kind).store(uint32_t(kind), std::memory_order_release);
+	}
+
+public:
+	// Creates or overwrites the file, its size is the limit of captured data
+	TrafficCapture(const std::string& fileName, int64_t capacity = int64_t(256) << 20) : _capacity(capacity) {
+		_file = ::open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (_file < 0)
+			throw std::runtime_error("Can't create capture file " + fileName);
+		if (::ftruncate(_file, _capacity) != 0) {
+			::close(_file);
+			throw std::runtime_error("Can't reserve space for capture file " + fileName);
+		}
+		void* mapped = ::mmap(nullptr, _capacity, PROT_READ | PROT_WRITE, MAP_SHARED, _file, 0);
+		if (mapped == MAP_FAILED) {
+			::close(_file);
+			throw std::runtime_error("Can't map capture file " + fileName);
+		}
+		_mapped = reinterpret_cast<char*>(mapped);
+		TrafficCaptureFormat::Header header = {};
+		std::copy(TrafficCaptureFormat::Magic.begin(), TrafficCaptureFormat::Magic.end(), header.magic.begin());
+		header.version = TrafficCaptureFormat::Version;
+		memcpy(_mapped, &header, sizeof(header));
+	}
+	TrafficCapture(const TrafficCapture&) = delete;
+	void operator=(const TrafficCapture&) = delete;
+
+	// The file is shortened to the captured data, no sessions may be recorded anymore
+	~TrafficCapture() {
+		::munmap(_mapped, _capacity);
+		::ftruncate(_file, std::min(_tail.load(), _capacity));
+		::close(_file);
+	}
+
+	uint64_t startSession() {
+		return _sessions.fetch_add(1, std::memory_order_relaxed);
+	}
+	void received(uint64_t session, std::span<const char> data) {
+		write(TrafficCaptureFormat::Kind::RECEIVED, session, data);
+	}
+	void closed(uint64_t session) {
+		write(TrafficCaptureFormat::Kind::CLOSED, session, {});
+	}
+
+	// Records that didn't fit into the file
+	int64_t dropped() const {
+		return _dropped.load(std::memory_order_relaxed);
+	}
+};
+
+// Passes everything to another responder and writes all received bytes into a capture. It sees messages possibly many times
+// until they are complete, but only bytes it didn't see before are recorded.
+template <typename Responder>
+class RecordingResponder {
+	Responder& _responder;
+	TrafficCapture& _capture;
+
+public:
+	RecordingResponder(Responder& responder, TrafficCapture& capture) : _responder(responder), _capture(capture) {}
+
+	class Session : public ITcpResponder {
+		typename Responder::Session _inner;
+		TrafficCapture* _capture;
+		uint64_t _id;
+		int64_t _recorded = 0; // Bytes at the start of the next input that were already recorded
+
+		Session(RecordingResponder& parent) : _inner(parent._responder.getSession()), _capture(&parent._capture),
+				_id(parent._capture.startSession()) {}
+		friend class RecordingResponder;
+
+	public:
+		Session(Session&& other) : _inner(std::move(other._inner)), _capture(other._capture), _id(other._id),
+				_recorded(other._recorded) {
+			other._capture = nullptr;
+		}
+		Session(const Session&) = delete;
+		void operator=(const Session&) = delete;
+
+		~Session() {
+			if (_capture)
+				_capture->closed(_id);
+		}
+
+		std::pair<ServerReaction, int64_t> respond(std::span<char> input, Callback<void(std::span<const char>)> writer) override {
+			// Recorded before the responder gets a chance to modify it
+			if (std::ssize(input) > _recorded) [[likely]]
+				_capture->received(_id, input.subspan(_recorded));
+			auto result = _inner.respond(input, writer);
+			if (result.first == ServerReaction::OK)
+				_recorded = std::max<int64_t>(std::ssize(input) - result.second, 0);
+			else
+				_recorded = std::max<int64_t>(std::ssize(input), _recorded);
+			return result;
+		}
+
+		bool readingBody() const requires requires(const typename Responder::Session& inner) { inner.readingBody(); } {
+			return _inner.readingBody();
+		}
+	};
+
+	Session getSession() {
+		return Session(*this);
+	}
+};
+
+struct TrafficReplayResults {
+	int64_t sessions = 0;
+	int64_t messages = 0; // Requests the responder accepted
+	int64_t bytesReceived = 0;
+	int64_t bytesSent = 0;
+	int64_t disconnected = 0; // Sessions the responder refused to continue
+	std::chrono::nanoseconds duration = {};
+};
+
+// Reads a capture file and feeds the recorded streams into a responder's sessions in the order they were received,
+// in the same process and without sockets
+class TrafficReplay {
+	struct Received {
+		uint64_t session;
+		std::chrono::nanoseconds time;
+		std::span<const char> data;
+		bool closed;
+	};
+	std::vector<char> _contents;
+	std::vector<Received> _received;
+
+public:
+	TrafficReplay(const std::string& fileName) {
+		int file = ::open(fileName.c_str(), O_RDONLY);
+		if (file < 0)
+			throw std::runtime_error("Can't open capture file " + fileName);
+		struct stat status = {};
+		::fstat(file, &status);
+		_contents.resize(status.st_size);
+		int64_t position = 0;
+		while (position < std::ssize(_contents)) {
+			auto got = ::read(file, _contents.data() + position, _contents.size() - position);
+			if (got <= 0)
+				break;
+			position += got;
+		}
+		::close(file);
+
+		TrafficCaptureFormat::Header header = {};
+		if (position < int64_t(sizeof(header)))
+			throw std::runtime_error("Capture file " + fileName + " is too short");
+		memcpy(&header, _contents.data(), sizeof(header));
+		if (std::string_view(header.magic.data(), header.magic.size()) != TrafficCaptureFormat::Magic
+				|| header.version != TrafficCaptureFormat::Version)
+			throw std::runtime_error(fileName + " is not a capture file of a known version");
+
+		int64_t read = sizeof(header);
+		while (read + int64_t(sizeof(TrafficCaptureFormat::Record)) <= position) {
+			TrafficCaptureFormat::Record record = {};
+			memcpy(&record, _contents.data() + read, sizeof(record));
+			auto kind = TrafficCaptureFormat::Kind(record.kind);
+			if (kind == TrafficCaptureFormat::Kind::END || read + TrafficCaptureFormat::recordSize(record.size) > position)
+				break;
+			_received.push_back({record.session, std::chrono::nanoseconds(record.time),
+					std::span<const char>(_contents.data() + read + sizeof(record), record.size),
+					kind == TrafficCaptureFormat::Kind::CLOSED});
+			read += TrafficCaptureFormat::recordSize(record.size);
+		}
+		// Records of different threads may be slightly out of order
+		std::stable_sort(_received.begin(), _received.end(), [] (const Received& first, const Received& second) {
+			return first.time < second.time;
+		});
+	}
+
+	// Feeds all recorded data into new sessions of the responder, either as fast as possible or with the original pacing
+	template <typename Responder>
+	TrafficReplayResults replay(Responder& responder, bool originalPacing = false) const {
+		struct SessionState {
+			std::optional<typename Responder::Session> session;
+			std::vector<char> pending;
+		};
+		std::unordered_map<uint64_t, SessionState> sessions;
+		TrafficReplayResults results;
+		auto writer = [&] (std::span<const char> output) {
+			results.bytesSent += output.size();
+		};
+
+		auto start = std::chrono::steady_clock::now();
+		for (const Received& received : _received) {
+			if (originalPacing)
+				std::this_thread::sleep_until(start + received.time);
+			auto [found, added] = sessions.try_emplace(received.session);
+			SessionState& state = found->second;
+			if (added) {
+				state.session.emplace(responder.getSession());
+				results.sessions++;
+			}
+			if (received.closed) {
+				sessions.erase(found);
+				continue;
+			}
+			if (!state.session)
+				continue; // The responder already refused it
+			results.bytesReceived += received.data.size();
+
+			// Processed the same way as by the server
+			state.pending.insert(state.pending.end(), received.data.begin(), received.data.end());
+			int64_t processed = 0;
+			while (processed < std::ssize(state.pending)) {
+				auto [reaction, parsed] = state.session->respond(std::span<char>(state.pending).subspan(processed), writer);
+				if (reaction == ServerReaction::DISCONNECT) {
+					state.session.reset();
+					results.disconnected++;
+					break;
+				}
+				if (reaction != ServerReaction::OK)
+					break;
+				results.messages++;
+				processed += parsed;
+			}
+			state.pending.erase(state.pending.begin(), state.pending.begin() + std::min<int64_t>(processed, state.pending.size()));
+		}
+		results.duration = std::chrono::steady_clock::now() - start;
+		return results;
+	}
+};
+
+} // namespace Bomba
+#endif // BOMBA_TRAFFIC_CAPTURE
@@ -0,0 +1,337 @@
+#ifndef BOMBA_UDP_HPP
+#define BOMBA_UDP_HPP
+
+#ifndef BOMBA_CORE // Needed to run in godbolt
+#include "bomba_core.hpp"
+#endif
+#include "bomba_response_matcher.hpp"
+
+#include <vector>
+#include <array>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <optional>
+#include <system_error>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+namespace Bomba {
+
+namespace Detail {
+
+// Largest payload of an IPv4 UDP datagram, longer ones are refused by the kernel
+constexpr int MaxUdpPayloadSize = 65535 - 20 - 8;
+
+// Received datagrams, each in a slot of its own, and the headers for receiving them all with one system call
+template <int BatchSize, int MaxDatagramSize>
+struct DatagramBatch {
+	std::vector<char> data = std::vector<char>(BatchSize * MaxDatagramSize);
+	std::array<mmsghdr, BatchSize> headers = {};
+	std::array<iovec, BatchSize> buffers = {};
+	std::array<sockaddr_in, BatchSize> addresses = {};
+
+	DatagramBatch() {
+		for (int i = 0; i < BatchSize; i++) {
+			buffers[i] = {data.data() + i * MaxDatagramSize, MaxDatagramSize};
+			headers[i].msg_hdr.msg_iov = &buffers[i];
+			headers[i].msg_hdr.msg_iovlen = 1;
+		}
+	}
+
+	// Returns the number of datagrams received without waiting
+	int receive(int socket) {
+		for (int i = 0; i < BatchSize; i++) {
+			headers[i].msg_hdr.msg_name = &addresses[i];
+			headers[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+		}
+		int received = ::recvmmsg(socket, headers.data(), BatchSize, MSG_DONTWAIT, nullptr);
+		if (received < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				return 0;
+			throw std::system_error(errno, std::system_category(), "receiving datagrams");
+		}
+		return received;
+	}
+
+	std::span<char> operator[](int index) {
+		return {data.data() + index * MaxDatagramSize, headers[index].msg_len};
+	}
+	bool truncated(int index) const {
+		return headers[index].msg_hdr.msg_flags & MSG_TRUNC;
+	}
+};
+
+// Datagrams waiting to be sent, all sent with as few system calls as possible
+template <int BatchSize>
+struct OutgoingDatagrams {
+	std::vector<char> data;
+	std::vector<std::pair<int64_t, int64_t>> positions; // Start and size in data
+	std::vector<sockaddr_in> addresses;
+
+	void add(std::span<const char> datagram, const sockaddr_in* address = nullptr) {
+		positions.emplace_back(data.size(), datagram.size());
+		data.insert(data.end(), datagram.begin(), datagram.end());
+		if (address)
+			addresses.push_back(*address);
+	}
+
+	bool empty() const {
+		return positions.empty();
+	}
+
+	// Datagrams that can't be sent (no buffer space and so on) are lost, like they would be in the network
+	void send(int socket) {
+		std::array<mmsghdr, BatchSize> headers = {};
+		std::array<iovec, BatchSize> buffers = {};
+		for (int start = 0; start < std::ssize(positions); ) {
+			int count = std::min<int>(BatchSize, positions.size() - start);
+			for (int i = 0; i < count; i++) {
+				auto [position, size] = positions[start + i];
+				buffers[i] = {data.data() + position, size_t(size)};
+				headers[i].msg_hdr = {};
+				headers[i].msg_hdr.msg_iov = &buffers[i];
+				headers[i].msg_hdr.msg_iovlen = 1;
+				if (!addresses.empty()) {
+					headers[i].msg_hdr.msg_name = &addresses[start + i];
+					headers[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+				}
+			}
+			int sent = ::sendmmsg(socket, headers.data(), count, 0);
+			if (sent <= 0) {
+				if (sent < 0 && errno == EINTR)
+					continue;
+				start += 1; // The first one can't be sent
+			} else {
+				start += sent;
+			}
+		}
+		data.clear();
+		positions.clear();
+		addresses.clear();
+	}
+};
+
+} // namespace Detail
+
+// Serves requests in UDP datagrams, each datagram must contain exactly one message and a response is sent in one datagram
+// to the address it came from. Suitable for the binary protocol, whose messages carry their identifiers.
+// There are no connections, so one session of the responder handles all datagrams. Datagrams that are not a complete message
+// are dropped without response.
+template <typename Responder, int BatchSize = 32, int MaxDatagramSize = 65536>
+class UdpServer {
+	Responder& _responder;
+	std::optional<typename Responder::Session> _session;
+	int _socket = -1;
+	int _waker = -1;
+	Detail::DatagramBatch<BatchSize, MaxDatagramSize> _received;
+	Detail::OutgoingDatagrams<BatchSize> _responses;
+	std::vector<char> _response;
+	std::atomic<bool> _stopped = false;
+	std::atomic<int64_t> _processed = 0;
+	std::atomic<int64_t> _dropped = 0;
+	std::atomic<bool> _responding = true;
+
+	void process(int count) {
+		for (int i = 0; i < count; i++) {
+			std::span<char> datagram = _received[i];
+			if (_received.truncated(i)) [[unlikely]] {
+				_dropped.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+			_response.clear();
+			auto [reaction, parsed] = _session->respond(datagram, [this] (std::span<const char> response) {
+				_response.insert(_response.end(), response.begin(), response.end());
+			});
+			if (reaction != ServerReaction::OK || parsed != std::ssize(datagram)) [[unlikely]] {
+				// The rest of an incomplete message will not come, the session must not wait for it
+				_session.emplace(_responder.getSession());
+				_dropped.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+			_processed.fetch_add(1, std::memory_order_relaxed);
+			if (_responding.load(std::memory_order_relaxed) && !_response.empty())
+				_responses.add(_response, &_received.addresses[i]);
+		}
+		if (!_responses.empty())
+			_responses.send(_socket);
+	}
+
+public:
+	UdpServer(Responder& responder, int port) : _responder(responder) {
+		_session.emplace(responder.getSession());
+		_socket = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+		if (_socket < 0) [[unlikely]]
+			throw std::system_error(errno, std::system_category(), "socket");
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+		address.sin_addr.s_addr = htonl(INADDR_ANY);
+		if (::bind(_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) [[unlikely]] {
+			int error = errno;
+			::close(_socket);
+			throw std::system_error(error, std::system_category(), "binding the UDP socket");
+		}
+		_waker = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (_waker < 0) [[unlikely]] {
+			int error = errno;
+			::close(_socket);
+			throw std::system_error(error, std::system_category(), "eventfd");
+		}
+	}
+
+	UdpServer(const UdpServer&) = delete;
+	UdpServer& operator=(const UdpServer&) = delete;
+
+	~UdpServer() {
+		::close(_socket);
+		::close(_waker);
+	}
+
+	// Serves requests until stopRunning() is called
+	void run() {
+		while (!_stopped.load(std::memory_order_relaxed)) {
+			std::array<pollfd, 2> waited = {pollfd{_socket, POLLIN, 0}, pollfd{_waker, POLLIN, 0}};
+			if (::poll(waited.data(), waited.size(), -1) < 0 && errno != EINTR) [[unlikely]]
+				throw std::system_error(errno, std::system_category(), "waiting for datagrams");
+			while (int count = _received.receive(_socket))
+				process(count);
+		}
+	}
+
+	// Serves the requests that were already received
+	void runARound() {
+		while (int count = _received.receive(_socket))
+			process(count);
+	}
+
+	void stopRunning() {
+		_stopped = true;
+		uint64_t one = 1;
+		[[maybe_unused]] auto written = ::write(_waker, &one, sizeof(one));
+	}
+
+	// A server that only receives notifications doesn't have to send anything back
+	void setResponding(bool responding) {
+		_responding = responding;
+	}
+
+	// Datagrams that were answered (or would be if responding)
+	int64_t processedCount() const {
+		return _processed.load(std::memory_order_relaxed);
+	}
+
+	// Datagrams that didn't contain exactly one valid message
+	int64_t droppedCount() const {
+		return _dropped.load(std::memory_order_relaxed);
+	}
+};
+
+// Sends each request in a datagram of its own and identifies responses by the identifiers in the messages.
+// Requests are queued and sent together when a response is needed, when too many are queued or when flush() is called,
+// requests that don't expect a response (notifications) need a flush() or the client's destruction to be sent.
+// Lost datagrams are not sent again, waiting for their responses fails after a timeout.
+class UdpClient : public ITcpClient {
+	constexpr static int BatchSize = 16;
+	constexpr static int MaxDatagramSize = 65536;
+	int _socket = -1;
+	std::chrono::milliseconds _timeout = std::chrono::seconds(1);
+	Detail::DatagramBatch<BatchSize, MaxDatagramSize> _received;
+	int _nextDatagram = 0; // Datagrams from the last batch that were not looked at yet
+	int _datagramCount = 0;
+	Detail::OutgoingDatagrams<BatchSize> _requests;
+	Detail::ResponseMatcher _matcher;
+
+	template <bool doWait, typename Reader>
+	void searchRequests(RequestToken tokenSought, Reader&& reader) {
+		flush();
+		if (_matcher.takeStored(tokenSought, reader))
+			return;
+
+		auto deadline = std::chrono::steady_clock::now() + _timeout;
+		while (true) {
+			// An incomplete message can't be completed by another datagram, it's dropped
+			while (_nextDatagram < _datagramCount) {
+				if (_matcher.processMessage(_received[_nextDatagram++], reader))
+					return;
+			}
+
+			_nextDatagram = 0;
+			_datagramCount = _received.receive(_socket);
+			if (_datagramCount > 0)
+				continue;
+			if constexpr(!doWait)
+				return;
+			auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+			if (remaining.count() <= 0) [[unlikely]]
+				remoteError("No response received in time, the datagram might have been lost");
+			pollfd waited = {_socket, POLLIN, 0};
+			::poll(&waited, 1, remaining.count() + 1);
+		}
+	}
+
+public:
+	UdpClient(const std::string& server, const std::string& port) {
+		addrinfo hints = {};
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_DGRAM;
+		addrinfo* resolved = nullptr;
+		if (int error = ::getaddrinfo(server.c_str(), port.c_str(), &hints, &resolved); error != 0 || !resolved) [[unlikely]]
+			throw std::system_error(std::make_error_code(std::errc::host_unreachable), "resolving " + server + ": " + gai_strerror(error));
+		_socket = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+		int connected = _socket < 0 ? -1 : ::connect(_socket, resolved->ai_addr, resolved->ai_addrlen);
+		int error = errno;
+		::freeaddrinfo(resolved);
+		if (connected < 0) [[unlikely]] {
+			if (_socket >= 0)
+				::close(_socket);
+			throw std::system_error(error, std::system_category(), "connecting the UDP socket");
+		}
+	}
+
+	UdpClient(const UdpClient&) = delete;
+	UdpClient& operator=(const UdpClient&) = delete;
+
+	~UdpClient() {
+		flush();
+		::close(_socket);
+	}
+
+	void writeRequest(std::span<char> written) override {
+		if (std::ssize(written) > Detail::MaxUdpPayloadSize) [[unlikely]]
+			logicError("The message is too long to fit into a datagram");
+		_requests.add(written);
+		if (std::ssize(_requests.positions) >= BatchSize)
+			flush();
+	}
+
+	// Sends all queued requests
+	void flush() {
+		if (!_requests.empty())
+			_requests.send(_socket);
+	}
+
+	void getResponse(RequestToken token, Callback<std::tuple<ServerReaction, RequestToken, int64_t>
+					(std::span<char> input, bool identified)> reader) override {
+		searchRequests<true>(token, reader);
+	}
+
+	void tryToGetResponse(RequestToken token, Callback<std::tuple<ServerReaction, RequestToken, int64_t>
+					(std::span<char> input, bool identified)> reader) override {
+		searchRequests<false>(token, reader);
+	}
+
+	// How long to wait for a response before assuming it was lost
+	void setTimeout(std::chrono::milliseconds timeout) {
+		_timeout = timeout;
+	}
+};
+
+} // namespace Bomba
+#endif // BOMBA_UDP_HPP
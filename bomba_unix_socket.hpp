@@ -0,0 +1,61 @@
+#ifndef BOMBA_UNIX_SOCKET_HPP
+#define BOMBA_UNIX_SOCKET_HPP
+
+#include <string>
+#include <system_error>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace Bomba {
+
+struct UnixSocketPath {
+	// Selects a Unix domain socket at the given path instead of a TCP port, for clients and servers on the same host
+	std::string path;
+};
+
+namespace Detail {
+
+inline sockaddr_un unixSocketAddress(const std::string& path) {
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) [[unlikely]]
+		throw std::system_error(std::make_error_code(std::errc::filename_too_long), "Unix socket path " + path);
+	memcpy(address.sun_path, path.data(), path.size());
+	return address;
+}
+
+// A file left at the path by a previous listener is removed, the caller is responsible for removing it after closing
+inline int listenOnUnixSocket(const std::string& path) {
+	sockaddr_un address = unixSocketAddress(path);
+	int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listener < 0) [[unlikely]]
+		throw std::system_error(errno, std::system_category(), "socket");
+	::unlink(path.c_str());
+	if (::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+			|| ::listen(listener, SOMAXCONN) < 0) [[unlikely]] {
+		int error = errno;
+		::close(listener);
+		throw std::system_error(error, std::system_category(), "binding the listening socket " + path);
+	}
+	return listener;
+}
+
+inline int connectToUnixSocket(const std::string& path) {
+	sockaddr_un address = unixSocketAddress(path);
+	int connection = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (connection < 0) [[unlikely]]
+		throw std::system_error(errno, std::system_category(), "socket");
+	if (::connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) [[unlikely]] {
+		int error = errno;
+		::close(connection);
+		throw std::system_error(error, std::system_category(), "connecting to " + path);
+	}
+	return connection;
+}
+
+} // namespace Detail
+} // namespace Bomba
+#endif // BOMBA_UNIX_SOCKET_HPP